@@ -1,68 +1,99 @@
 // Crude circular queue buffering library for rcopy Project 3 Networks 464 class
 
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
 #include "buffer.h"
 
-// globs
-PacketBuffer *pb = NULL;
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // Linux UIO_MAXIOV, limits.h only has it with _XOPEN_SOURCE
+#endif
+
+static int submitStaged(PacketBuffer *pb);
+static int waitWrite(PacketBuffer *pb);
+static int stageWrite(PacketBuffer *pb, uint8_t *data, int len);
+static int stageChunk(PacketBuffer *pb, uint8_t *chunk, int chunkLen);
+static int writeAll(int fd, uint8_t *data, int len, off_t offset);
+static int writeRun(PacketBuffer *pb, uint32_t runLen);
+static int writevAll(int fd, struct iovec *iov, int iovCount, off_t offset);
 
 // func defs start
 
-// setup packet buffer
-void initPacketBuffer(uint32_t winSize, int32_t buffSize, int outFileFd)
+// setup a packet buffer, returns the new buffer or NULL on error
+PacketBuffer *initPacketBuffer(uint32_t winSize, int32_t buffSize, int outFileFd)
 {
-    if (pb != NULL || winSize > MAX_PACKS || winSize == 0 || outFileFd < 0)
+    if (winSize > MAX_PACKS || winSize == 0 || outFileFd < -1)
     {
-        fprintf(stderr, "Error: Invalid packet buffer or window size or output file descriptor.\n");
-        return;
+        fprintf(stderr, "Error: Invalid window size or output file descriptor.\n");
+        return NULL;
     }
 
-    pb = (PacketBuffer *)calloc(1, sizeof(PacketBuffer));
+    PacketBuffer *pb = (PacketBuffer *)calloc(1, sizeof(PacketBuffer));
     if (pb == NULL)
     {
         fprintf(stderr, "Error: Failed to allocate memory for packet buffer.\n");
-        return;
+        return NULL;
     }
 
-    pb->buffer = (Packet *)calloc(winSize, sizeof(Packet));
-    if (pb->buffer == NULL)
+    // one slab: [Packet array][cache line aligned data slots][RECV_BATCH receive slots], flushBuffer()
+    // walks the first two at a fixed stride - power of two slots so a packet's slot is seqNum & mask
+    uint32_t slots = ringSize(winSize);
+    size_t packetsLen = SLAB_ROUND((size_t)slots * sizeof(Packet));
+    size_t stride = SLAB_ROUND(buffSize);
+    pb->slab = allocSlab(packetsLen + (size_t)(slots + RECV_BATCH) * stride, &pb->slabLen);
+    if (pb->slab == NULL)
     {
         fprintf(stderr, "Error: Failed to allocate memory for packet buffer array.\n");
         free(pb);
-        pb = NULL;
-        return;
+        return NULL;
     }
+    pb->buffer = (Packet *)pb->slab;
 
     // initialize each packet in the buffer
-    for (int i = 0; i < winSize; i++)
+    for (uint32_t i = 0; i < slots; i++)
     {
-        pb->buffer[i].packetData = (uint8_t *)calloc(buffSize, sizeof(uint8_t));
-        if (pb->buffer[i].packetData == NULL)
-        {
-            fprintf(stderr, "Error: Failed to allocate memory for packet data at index %d.\n", i);
-            // free all previously allocated packets
-            for (int j = 0; j < i; j++)
-            {
-                free(pb->buffer[j].packetData);
-                pb->buffer[j].packetData = NULL;
-            }
-            free(pb->buffer);
-            free(pb);
-            pb = NULL;
-            return;
-        }
+        pb->buffer[i].packetData = &pb->slab[packetsLen + (size_t)i * stride];
         pb->buffer[i].packetLen = 0;
         pb->buffer[i].written = 1;  // mark packets as written initially meaning open for adding
     }
+    for (int i = 0; i < RECV_BATCH; i++)
+    {
+        pb->recvSlots[i] = &pb->slab[packetsLen + (size_t)(slots + i) * stride];
+    }
+    pb->slotLen = buffSize;
+
+    if (WRITE_BEHIND_LEN > 0 && (pb->stage = (uint8_t *)malloc(WRITE_BEHIND_LEN)) == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for write-behind staging buffer.\n");
+        freeSlab(pb->slab, pb->slabLen);
+        free(pb);
+        return NULL;
+    }
+
+    // with IO_URING the stage is double buffered, one half fills while the kernel writes the other
+    if (WRITE_BEHIND_LEN > 0 && (pb->ring = initUring(URING_ENTRIES)) != NULL &&
+        (pb->spare = (uint8_t *)malloc(WRITE_BEHIND_LEN)) == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for the second staging buffer, using pwrite().\n");
+        freeUring(pb->ring);
+        pb->ring = NULL;
+    }
 
     // initialize packet buffer metadata
     pb->winSize = winSize;
+    pb->mask = slots - 1;
     pb->nextSeqNum = 1;
     pb->storedPackets = 0;
     pb->outFileFd = outFileFd;
+    pb->stageLen = 0;
+    pb->fileOffset = 0;
+
+    return pb;
 }
 
-// self explanatory
-void freePacketBuffer()
+// self explanatory - anything still staged is written out first
+void freePacketBuffer(PacketBuffer *pb)
 {
         if (pb == NULL)
     {
@@ -70,20 +101,21 @@ void freePacketBuffer()
         return;
     }
 
+    flushStaged(pb);
+    freeUring(pb->ring);
+    pb->ring = NULL;
+    free(pb->stage);
+    pb->stage = NULL;
+    free(pb->spare);
+    pb->spare = NULL;
+    free(pb->plain);
+    pb->plain = NULL;
+
     if (pb->buffer)
     {
-        for (uint32_t i = 0; i < pb->winSize; i++)
-        {
-            Packet *packet = &pb->buffer[i];
-            if (packet->packetData)
-            {
-                free(packet->packetData);
-                packet->packetData = NULL;
-                packet->packetLen = 0;
-                packet->written = 0;
-            }
-        }
-        free(pb->buffer);
+        // the Packet array and every slot live in the slab
+        freeSlab(pb->slab, pb->slabLen);
+        pb->slab = NULL;
         pb->buffer = NULL;
         pb->winSize = 0;
         pb->nextSeqNum = 0;
@@ -91,11 +123,10 @@ void freePacketBuffer()
         pb->outFileFd = -1;
     }
     free(pb);
-    pb = NULL;
- }
+}
 
 // add a packet to the buffer
-int addPacket(uint8_t *packet, int packetLen, uint32_t seqNum)
+int addPacket(PacketBuffer *pb, uint8_t *packet, int packetLen, uint32_t seqNum)
 {
     if (pb == NULL || packet == NULL || packetLen <= 0 || seqNum < 1)
     {
@@ -106,9 +137,6 @@ int addPacket(uint8_t *packet, int packetLen, uint32_t seqNum)
         return -1;
     }
 
-    // first valid packet arrival
-    if (pb->storedPackets == 0) pb->nextSeqNum = seqNum;
-
     if (seqNum < pb->nextSeqNum || seqNum >= pb->nextSeqNum + pb->winSize)
     {
         if (DEBUG_FLAG)
@@ -118,7 +146,7 @@ int addPacket(uint8_t *packet, int packetLen, uint32_t seqNum)
         return -1;
     }
 
-    uint32_t idx = seqNum % pb->winSize;
+    uint32_t idx = seqNum & pb->mask;
     Packet *pkt = &pb->buffer[idx];
 
     if (!pkt->written)
@@ -147,8 +175,114 @@ int addPacket(uint8_t *packet, int packetLen, uint32_t seqNum)
     return 0; // success
 }
 
+// zero copy addPacket(): the data was received straight into recvSlots[slot], so that slot
+// becomes the packet's and the packet's free slot takes its place in recvSlots - returns 0 (also
+// for a duplicate, which keeps its slot) or -1 on error
+int addRecvSlot(PacketBuffer *pb, int slot, int packetLen, uint32_t seqNum)
+{
+    if (pb == NULL || slot < 0 || slot >= RECV_BATCH || packetLen <= 0 || packetLen > pb->slotLen ||
+        seqNum < pb->nextSeqNum || seqNum >= pb->nextSeqNum + pb->winSize)
+    {
+        if (DEBUG_FLAG)
+        {
+            fprintf(stderr, "Error: Invalid parameters for addRecvSlot, sequence number %u slot %d.\n", seqNum, slot);
+        }
+        return -1;
+    }
+
+    Packet *pkt = &pb->buffer[seqNum & pb->mask];
+    if (!pkt->written)
+    {
+        return 0;   // already buffered
+    }
+
+    uint8_t *freeSlot = pkt->packetData;
+    pkt->packetData = pb->recvSlots[slot];
+    pkt->packetLen = packetLen;
+    pkt->written = 0;
+    pb->recvSlots[slot] = freeSlot;
+    pb->storedPackets++;
+
+    return 0;
+}
+
+// self explanatory
+uint8_t **getRecvSlots(PacketBuffer *pb)
+{
+    return (pb != NULL) ? pb->recvSlots : NULL;
+}
+
+int32_t getSlotLen(PacketBuffer *pb)
+{
+    return (pb != NULL) ? pb->slotLen : -1;
+}
+
+// where the first in-order byte goes in the output file, one stream's range of a shared file
+// starts part way in - call before any data is written, returns 0 or -1 on error
+int setWriteOffset(PacketBuffer *pb, off_t offset)
+{
+    if (pb == NULL || offset < 0 || pb->fileOffset != 0 || pb->stageLen != 0)
+    {
+        fprintf(stderr, "Error: Invalid parameters for setWriteOffset.\n");
+        return -1;
+    }
+    pb->fileOffset = offset;
+    return 0;
+}
+
+// the in-order packet is a batch's NEXT_FILE: everything before it goes into the old file, it
+// takes up its seqNum without any data and what's buffered behind it goes into outFileFd from
+// offset 0 - returns the bytes flushed behind it or -1 on error
+int switchOutput(PacketBuffer *pb, int outFileFd)
+{
+    if (pb == NULL || !pb->buffer[pb->nextSeqNum & pb->mask].written)
+    {
+        fprintf(stderr, "Error: Invalid parameters for switchOutput.\n");
+        return -1;
+    }
+    if (flushStaged(pb) < 0)
+    {
+        return -1;
+    }
+    pb->outFileFd = outFileFd;
+    pb->fileOffset = 0;
+    pb->nextSeqNum++;
+    return flushBuffer(pb);
+}
+
+// packets hold codec chunks from here on, file offsets and the bytes returned by the writes
+// count what they unpack to - returns 0 or -1 on error
+int setCodec(PacketBuffer *pb, int codec)
+{
+    if (pb == NULL || codec < CODEC_NONE || codec > CODEC_LZ4)
+    {
+        fprintf(stderr, "Error: Invalid parameters for setCodec.\n");
+        return -1;
+    }
+    if (codec != CODEC_NONE && WRITE_BEHIND_LEN < CODEC_MAX_IN && pb->plain == NULL &&
+        (pb->plain = (uint8_t *)malloc(CODEC_MAX_IN)) == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for unpacking chunks.\n");
+        return -1;
+    }
+    pb->codec = codec;
+    return 0;
+}
+
+// file offset just past the last in-order byte, written or still staged - after flushStaged()
+// everything before it is in the file
+off_t getWriteOffset(PacketBuffer *pb)
+{
+    if (pb == NULL)
+    {
+        fprintf(stderr, "Error: Invalid parameters for getWriteOffset.\n");
+        return -1;
+    }
+    return pb->fileOffset + pb->stageLen;
+}
+
 // get a packet from the buffer - DEPRACTED DO NOT USE
-int getPacket(uint8_t *packet, int *packetLen, uint32_t seqNum)
+int getPacket(PacketBuffer *pb, uint8_t *packet, int *packetLen, uint32_t seqNum)
 {
     if (pb == NULL || packet == NULL || packetLen == NULL || seqNum < pb->nextSeqNum ||
         seqNum >= pb->nextSeqNum + pb->winSize)
@@ -160,7 +294,7 @@ int getPacket(uint8_t *packet, int *packetLen, uint32_t seqNum)
         return -1; // invalid parameters
     }
 
-    uint32_t idx = seqNum % pb->winSize;
+    uint32_t idx = seqNum & pb->mask;
     Packet *pkt = &pb->buffer[idx];
 
     if (pkt->packetData == NULL)
@@ -183,62 +317,347 @@ int getPacket(uint8_t *packet, int *packetLen, uint32_t seqNum)
     return 0; // success
 }
 
-// returns number of bytes written on success or -1 on error
-int flushBuffer()
+// write the next in-order packet straight to the output file, then flush whatever was
+// buffered behind it - returns number of bytes written on success or -1 on error
+int writePacket(PacketBuffer *pb, uint8_t *packet, int packetLen)
+{
+    if (pb == NULL || packet == NULL || packetLen < 0)
+    {
+        fprintf(stderr, "Error: Invalid parameters for writePacket.\n");
+        return -1;
+    }
+
+    int bytesWritten = (pb->codec != CODEC_NONE) ? stageChunk(pb, packet, packetLen) : stageWrite(pb, packet, packetLen);
+    if (bytesWritten < 0)
+    {
+        fprintf(stderr, "Error writing in-order packet %u to output file\n", pb->nextSeqNum);
+        return -1;
+    }
+
+    // the slot for this seqNum may still hold a copy that arrived earlier, drop it
+    Packet *pkt = &pb->buffer[pb->nextSeqNum & pb->mask];
+    if (!pkt->written)
+    {
+        pkt->packetLen = 0;
+        pkt->written = 1;
+        pb->storedPackets--;
+    }
+    pb->nextSeqNum++;
+
+    if (!needFlush(pb)) return bytesWritten;
+
+    int flushed = flushBuffer(pb);
+    if (flushed < 0) return -1;
+    return bytesWritten + flushed;
+}
+
+// writes the contiguous run of buffered packets starting at nextSeqNum - a run that fits in the
+// write-behind stage is copied there, a bigger one goes out with the stage in front of it in one
+// pwritev() straight from the slots - returns number of bytes written on success or -1 on error
+int flushBuffer(PacketBuffer *pb)
+{
+    if (pb == NULL)
+    {
+        fprintf(stderr, "Error: Packet buffer is NULL.\n");
+        return -1;
+    }
+    uint32_t runLen = 0;
+    int runBytes = 0;
+
+    // find the run, it stops at the first written or open packet
+    while (runLen < pb->winSize && !pb->buffer[(pb->nextSeqNum + runLen) & pb->mask].written)
+    {
+        runBytes += pb->buffer[(pb->nextSeqNum + runLen) & pb->mask].packetLen;
+        runLen++;
+    }
+    if (runLen == 0)
+    {
+        return 0;
+    }
+
+    if (pb->codec != CODEC_NONE)
+    {
+        // chunks only know their length once unpacked, they go into the stage one at a time
+        runBytes = 0;
+        for (uint32_t i = 0; i < runLen; i++)
+        {
+            Packet *pkt = &pb->buffer[(pb->nextSeqNum + i) & pb->mask];
+            int len = stageChunk(pb, pkt->packetData, pkt->packetLen);
+            if (len < 0)
+            {
+                fprintf(stderr, "Error flushing buffered packet %u to output file\n", pb->nextSeqNum + i);
+                return -1;
+            }
+            runBytes += len;
+        }
+    }
+    else if (WRITE_BEHIND_LEN > 0 && pb->stageLen + runBytes <= WRITE_BEHIND_LEN)
+    {
+        for (uint32_t i = 0; i < runLen; i++)
+        {
+            Packet *pkt = &pb->buffer[(pb->nextSeqNum + i) & pb->mask];
+            __builtin_prefetch(pb->buffer[(pb->nextSeqNum + i + 1) & pb->mask].packetData); // next slot is next
+            stageWrite(pb, pkt->packetData, pkt->packetLen); // fits, can't fail
+        }
+    }
+    else if (writeRun(pb, runLen) < 0)
+    {
+        fprintf(stderr, "Error flushing %u buffered packets from seqNum %u to output file\n", runLen, pb->nextSeqNum);
+        return -1;
+    }
+
+    // release the run, the data stays until the slots are reused
+    for (uint32_t i = 0; i < runLen; i++)
+    {
+        Packet *pkt = &pb->buffer[(pb->nextSeqNum + i) & pb->mask];
+        pkt->packetLen = 0;
+        pkt->written = 1;
+    }
+    pb->storedPackets -= runLen;
+    pb->nextSeqNum += runLen;
+
+    // packets past a hole stay counted in storedPackets until they're flushed
+    return runBytes;
+}
+
+// writes the staged in-order data to the file and waits for any write still in flight,
+// everything received is in the file after this - returns 0 or -1 on error
+int flushStaged(PacketBuffer *pb)
 {
     if (pb == NULL)
     {
         fprintf(stderr, "Error: Packet buffer is NULL.\n");
         return -1;
     }
-    int totBytesWritten = 0;
-    int bytesWritten = 0;
+    if (submitStaged(pb) < 0 || waitWrite(pb) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// hands the stage to the disk: one pwrite(), or with a ring the write is queued and the stage
+// swapped for the spare so rcopy goes back to receiving while the kernel writes - 0 or -1 on error
+static int submitStaged(PacketBuffer *pb)
+{
+    uint8_t *full = pb->stage;
+
+    if (pb->stageLen == 0)
+    {
+        return 0;
+    }
+    if (pb->ring == NULL)
+    {
+        if (writeAll(pb->outFileFd, pb->stage, pb->stageLen, pb->fileOffset) < 0)
+        {
+            perror("flushStaged, pwrite");
+            return -1;
+        }
+    }
+    else
+    {
+        // the spare is only free once its write is done
+        if (waitWrite(pb) < 0 || uringWrite(pb->ring, pb->outFileFd, full, pb->stageLen, pb->fileOffset, 0) < 0)
+        {
+            return -1;
+        }
+        pb->aioLen = pb->stageLen;
+        pb->aioOffset = pb->fileOffset;
+        pb->stage = pb->spare;
+        pb->spare = full;
+    }
+    pb->fileOffset += pb->stageLen;
+    pb->stageLen = 0;
+    return 0;
+}
+
+// waits for the write in flight, a short write is finished off with pwrite() - 0 or -1 on error
+static int waitWrite(PacketBuffer *pb)
+{
+    uint64_t tag = 0;
+    int32_t res = 0;
+    int len = pb->aioLen;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+    pb->aioLen = 0;
+    if (uringWait(pb->ring, &tag, &res) < 0)
+    {
+        return -1;
+    }
+    if (res < 0)
+    {
+        errno = -res;
+        perror("flushStaged, io_uring write");
+        return -1;
+    }
+    if (res < len && writeAll(pb->outFileFd, &pb->spare[res], len - res, pb->aioOffset + res) < 0)
+    {
+        perror("flushStaged, pwrite");
+        return -1;
+    }
+    return 0;
+}
+
+// write-behind: in-order data is copied into the staging buffer and only hits the file once
+// the buffer fills, so each syscall writes WRITE_BEHIND_LEN bytes instead of one packet -
+// returns len (counted as written) or -1 on error
+static int stageWrite(PacketBuffer *pb, uint8_t *data, int len)
+{
+    if (pb->stageLen + len > WRITE_BEHIND_LEN && submitStaged(pb) < 0)
+    {
+        return -1;
+    }
+    if (WRITE_BEHIND_LEN == 0 || len > WRITE_BEHIND_LEN)
+    {
+        // write through, staging is off or smaller than a packet
+        if (writeAll(pb->outFileFd, data, len, pb->fileOffset) < 0)
+        {
+            return -1;
+        }
+        pb->fileOffset += len;
+        return len;
+    }
+    memcpy(&pb->stage[pb->stageLen], data, len);
+    pb->stageLen += len;
+    return len;
+}
+
+// a chunk unpacks straight into the stage when CODEC_MAX_IN fits there, through plain when the
+// stage is smaller - returns the file bytes it held (counted as written) or -1 on error
+static int stageChunk(PacketBuffer *pb, uint8_t *chunk, int chunkLen)
+{
+    int len = 0;
+
+    if (WRITE_BEHIND_LEN >= CODEC_MAX_IN)
+    {
+        if (pb->stageLen + CODEC_MAX_IN > WRITE_BEHIND_LEN && submitStaged(pb) < 0)
+        {
+            return -1;
+        }
+        if ((len = unpackChunk(chunk, chunkLen, &pb->stage[pb->stageLen], CODEC_MAX_IN)) < 0)
+        {
+            return -1;
+        }
+        pb->stageLen += len;
+        return len;
+    }
+    if ((len = unpackChunk(chunk, chunkLen, pb->plain, CODEC_MAX_IN)) < 0)
+    {
+        return -1;
+    }
+    return stageWrite(pb, pb->plain, len);
+}
+
+// one pwritev() per IOV_MAX iovecs at fileOffset: the staged bytes first, then the run's slots
+// in seqNum order - returns 0 or -1 on error
+static int writeRun(PacketBuffer *pb, uint32_t runLen)
+{
+    struct iovec iov[(runLen + 1 < IOV_MAX) ? runLen + 1 : IOV_MAX];
+    int iovCount = 0;
+    off_t offset = pb->fileOffset;
+    int chunkLen = 0;
 
-    // write all packets that have been received and not written to the output file up to nextSeqNum
-    for (int i = 0; i < pb->winSize; i++)
+    if (pb->stageLen > 0)
     {
-        uint32_t idx = pb->nextSeqNum % pb->winSize;
-        Packet *pkt = &pb->buffer[idx];
+        iov[iovCount].iov_base = pb->stage;
+        iov[iovCount++].iov_len = pb->stageLen;
+        chunkLen += pb->stageLen;
+    }
+    for (uint32_t i = 0; i < runLen; i++)
+    {
+        Packet *pkt = &pb->buffer[(pb->nextSeqNum + i) & pb->mask];
+        iov[iovCount].iov_base = pkt->packetData;
+        iov[iovCount++].iov_len = pkt->packetLen;
+        chunkLen += pkt->packetLen;
 
-        if (pkt->packetData && !pkt->written)
+        if (iovCount == IOV_MAX || i == runLen - 1)
         {
-            bytesWritten = write(pb->outFileFd, pkt->packetData, pkt->packetLen);
-            if (bytesWritten < 0)
+            if (writevAll(pb->outFileFd, iov, iovCount, offset) < 0)
             {
-                fprintf(stderr, "Error flushing buffer packet at idx %u to output file\n", idx);
+                perror("flushBuffer, pwritev");
                 return -1;
             }
+            offset += chunkLen;
+            iovCount = 0;
+            chunkLen = 0;
+        }
+    }
 
-            // //~!*> fsync the file to ensure data is written to disk
-            // if (fsync(pb->outFileFd) < 0)
-            // {
-            //     fprintf(stderr, "Error syncing output file after writing packet at idx %u\n", idx);
-            //     return -1;
-            // }
-
-            totBytesWritten += bytesWritten;
-            memset(pkt->packetData, 0, pkt->packetLen);
-            pkt->packetLen = 0;
-            pkt->written = 1;
-            pb->storedPackets--;
-            pb->nextSeqNum++;
+    pb->fileOffset = offset;
+    pb->stageLen = 0;
+    return 0;
+}
+
+// pwritev() until every iovec is in, a short write resumes mid iovec (iov is used up) - a write
+// that makes no progress is an error, it would only loop
+static int writevAll(int fd, struct iovec *iov, int iovCount, off_t offset)
+{
+    while (iovCount > 0)
+    {
+        ssize_t ret = pwritev(fd, iov, iovCount, offset);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ret == 0 && iov->iov_len > 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        offset += ret;
+        while (iovCount > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovCount--;
         }
-        else
+        if (iovCount > 0)
         {
-            // stop at first written or open packet
-            break;
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
         }
     }
+    return 0;
+}
+
+// pwrite() until all len bytes are in, a regular file can still take a short write - like
+// writevAll() a signal retries and a write that makes no progress is an error
+static int writeAll(int fd, uint8_t *data, int len, off_t offset)
+{
+    int done = 0;
 
-    // pb->nextSeqNum = 0; // reset nextSeqNum to something it should never be
-    pb->storedPackets = 0; // reset stored packets after flushing
-    return totBytesWritten;
+    while (done < len)
+    {
+        ssize_t ret = pwrite(fd, &data[done], len - done, offset + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ret == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        done += ret;
+    }
+    return done;
 }
 
 // returns 1 if the packet is written, 0 if not, -1 on error
-int isWritten(uint32_t seqNum)
+int isWritten(PacketBuffer *pb, uint32_t seqNum)
 {
-    uint32_t idx = seqNum % pb->winSize;
+    if (pb == NULL)
+    {
+        fprintf(stderr, "Error: Packet buffer is NULL.\n");
+        return -1; // error
+    }
+
+    uint32_t idx = seqNum & pb->mask;
     Packet *pkt = &pb->buffer[idx];
 
     if (pkt->written) return 1;
@@ -246,8 +665,33 @@ int isWritten(uint32_t seqNum)
     return 0;
 }
 
+// fills bitmap with one bit per seqNum starting at nextSeqNum, bit i (bitmap[i / 8] & (1 << (i % 8)))
+// set means nextSeqNum + i is sitting in the buffer - returns the bytes used up to the highest set bit,
+// 0 if nothing is buffered, or -1 on error
+int getSackMap(PacketBuffer *pb, uint8_t *bitmap, int mapLen)
+{
+    if (pb == NULL || bitmap == NULL || mapLen <= 0)
+    {
+        fprintf(stderr, "Error: Invalid parameters for getSackMap.\n");
+        return -1;
+    }
+    int usedLen = 0;
+
+    memset(bitmap, 0, mapLen);
+    for (uint32_t i = 0; i < pb->winSize && i < (uint32_t)mapLen * 8; i++)
+    {
+        // slots in [nextSeqNum, nextSeqNum + winSize) map one to one so written alone says it all
+        if (!pb->buffer[(pb->nextSeqNum + i) & pb->mask].written)
+        {
+            bitmap[i / 8] |= (1 << (i % 8));
+            usedLen = i / 8 + 1;
+        }
+    }
+    return usedLen;
+}
+
 // return the next sequence number to write
-int getNextSeqNum()
+int getNextSeqNum(PacketBuffer *pb)
 {
     if (pb == NULL)
     {
@@ -258,7 +702,7 @@ int getNextSeqNum()
 }
 
 // returns the number of packets currently stored in the buffer
-int getStoredPackets()
+int getStoredPackets(PacketBuffer *pb)
 {
     if (pb == NULL)
     {
@@ -269,7 +713,7 @@ int getStoredPackets()
 }
 
 // returns 1 if the buffer is not full, 0 if it is full
-int bufferOpen()
+int bufferOpen(PacketBuffer *pb)
 {
     if (pb == NULL)
     {
@@ -285,7 +729,7 @@ int bufferOpen()
 }
 
 // returns 1 if there are packets to write, 0 if not
-int needFlush()
+int needFlush(PacketBuffer *pb)
 {
     if (pb == NULL)
     {
@@ -10,8 +10,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "uring.h"
+#include "slab.h"
+#include "srej.h"
+#include "codec.h"
+
+#ifndef DEBUG_FLAG
 #define DEBUG_FLAG 1         // ~!*
+#endif
 #define MAX_PACKS 1073741824 // 2^30 bytes = 1 GiB - winSize must be less than this number
+#ifndef WRITE_BEHIND_LEN
+#define WRITE_BEHIND_LEN (1 << 20) // in-order data is staged until this many bytes go out in one pwrite(), 0 = write through
+#endif
 
 typedef struct
 {
@@ -23,23 +33,48 @@ typedef struct
 typedef struct
 {
     uint32_t winSize; // number of packets in flight - size of the associated window and therefore buffer
+    uint32_t mask;    // buffer has mask + 1 (winSize rounded up to a power of two) slots
     Packet *buffer;
-    uint32_t nextSeqNum; // next sequence number to write
+    uint32_t nextSeqNum; // next sequence number to write - the receiver's expected seqNum
     int storedPackets;   // number of packets currently stored in the buffer
     int outFileFd;      // file descriptor for the output file to be written to
+    uint8_t *stage;     // write-behind staging buffer, WRITE_BEHIND_LEN bytes
+    int stageLen;       // bytes staged and not yet in the file
+    off_t fileOffset;   // file offset the staged bytes start at
+    Uring *ring;        // IO_URING: stage writes go out asynchronously, NULL = pwrite()
+    uint8_t *spare;     // IO_URING: second stage, being written while the other fills
+    int aioLen;         // bytes of spare still in flight, 0 = none
+    off_t aioOffset;    // file offset of the write in flight
+    uint8_t *slab;      // one mapping holding buffer and every packet's data slot
+    size_t slabLen;
+    int32_t slotLen;    // bytes in a data slot, rcopy's buffSize
+    uint8_t *recvSlots[RECV_BATCH]; // free slots recvBuffs() scatters data into, swapped into buffer by addRecvSlot()
+    int codec;          // CODEC_NONE, or each data packet is a chunk unpacked on its way into the stage
+    uint8_t *plain;     // CODEC_MAX_IN bytes to unpack into when the stage is smaller than a chunk
 } PacketBuffer;
 
-void initPacketBuffer(uint32_t winSize, int32_t buffSize, int outFileFd);
-void freePacketBuffer();
+// every call takes the buffer it works on so one process can run many transfers at once
+PacketBuffer *initPacketBuffer(uint32_t winSize, int32_t buffSize, int outFileFd); // -1 = none yet (a batch)
+void freePacketBuffer(PacketBuffer *pb);
 
-int addPacket(uint8_t *packet, int packetLen, uint32_t seqNum);
-int getPacket(uint8_t *packet, int *packetLen, uint32_t seqNum);    // X
-int flushBuffer(); // write packets to the output file and slide
+int addPacket(PacketBuffer *pb, uint8_t *packet, int packetLen, uint32_t seqNum);
+int addRecvSlot(PacketBuffer *pb, int slot, int packetLen, uint32_t seqNum); // addPacket() for data already in recvSlots[slot], no copy
+uint8_t **getRecvSlots(PacketBuffer *pb); // RECV_BATCH free slots of getSlotLen() bytes to receive into
+int32_t getSlotLen(PacketBuffer *pb);
+int getPacket(PacketBuffer *pb, uint8_t *packet, int *packetLen, uint32_t seqNum);    // X
+int writePacket(PacketBuffer *pb, uint8_t *packet, int packetLen); // write the in-order packet then flush
+int flushBuffer(PacketBuffer *pb); // write packets to the output file and slide
+int flushStaged(PacketBuffer *pb); // push staged write-behind data into the file, call before reporting EOF
+int setWriteOffset(PacketBuffer *pb, off_t offset); // file offset the data starts at, before anything is written
+off_t getWriteOffset(PacketBuffer *pb); // file offset after the last in-order byte
+int switchOutput(PacketBuffer *pb, int outFileFd); // take the in-order NEXT_FILE and carry on into outFileFd
+int setCodec(PacketBuffer *pb, int codec); // what the data packets are packed with, before any arrive
 
-int isWritten(uint32_t seqNum); // returns 1 if packet is written, 0 if not
-int getNextSeqNum();
-int getStoredPackets();
-int bufferOpen(); // 1 = open, 0 = full
-int needFlush(); // 1 = has packets, 0 = no packets to write
+int isWritten(PacketBuffer *pb, uint32_t seqNum); // returns 1 if packet is written, 0 if not
+int getSackMap(PacketBuffer *pb, uint8_t *bitmap, int mapLen); // bitmap of buffered packets from nextSeqNum
+int getNextSeqNum(PacketBuffer *pb);
+int getStoredPackets(PacketBuffer *pb);
+int bufferOpen(PacketBuffer *pb); // 1 = open, 0 = full
+int needFlush(PacketBuffer *pb); // 1 = has packets, 0 = no packets to write
 
 #endif
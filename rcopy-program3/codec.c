@@ -0,0 +1,270 @@
+// per packet compression for the rcopy Project 3 Networks 464 class - every pane is one self
+// contained chunk, an LZ4 block or the plain bytes when packing them doesn't pay
+
+#include "codec.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_LOG 12      // 4096 entry match finder table
+#define LZ_MAX_OFFSET 65535
+#define LZ_MF_LIMIT 12      // LZ4's end rules: a match starts at least this far before the end
+#define LZ_LAST_LITERALS 5  // and stops at least this far before it
+
+static int32_t lzCompress(const uint8_t *src, int32_t srcLen, uint8_t *dst, int32_t dstCap, int32_t *consumed);
+static int32_t lzDecompress(const uint8_t *src, int32_t srcLen, uint8_t *dst, int32_t dstCap);
+static int32_t lenBytes(int32_t len);
+static uint8_t *putLen(uint8_t *op, int32_t len);
+
+// func defs start
+
+int findCodec(const char *name)
+{
+    if (name == NULL || strcmp(name, "none") == 0)
+    {
+        return CODEC_NONE;
+    }
+    if (strcmp(name, "lz4") == 0)
+    {
+        return CODEC_LZ4;
+    }
+    return -1;
+}
+
+// every chunk decodes on its own, so a pane resent on SREJ or timeout is still a whole packet
+int32_t packChunk(int codec, const uint8_t *plain, int32_t plainLen, uint8_t *chunk, int32_t chunkCap, int32_t *consumed)
+{
+    int32_t len = 0;
+    int32_t rawLen = 0;
+
+    if (plain == NULL || chunk == NULL || consumed == NULL || plainLen < 0 || chunkCap < 2)
+    {
+        fprintf(stderr, "Error: Invalid parameters for packChunk.\n");
+        return -1;
+    }
+    if (plainLen > CODEC_MAX_IN)
+    {
+        plainLen = CODEC_MAX_IN;
+    }
+    rawLen = (plainLen < chunkCap - 1) ? plainLen : chunkCap - 1;
+
+    // compressed only if it carries more of the file than storing would, or the same in fewer bytes
+    if (codec == CODEC_LZ4 && (len = lzCompress(plain, plainLen, &chunk[1], chunkCap - 1, consumed)) >= 0 &&
+        (*consumed > rawLen || (*consumed == plainLen && len < plainLen)))
+    {
+        chunk[0] = CHUNK_LZ4;
+        return len + 1;
+    }
+
+    chunk[0] = CHUNK_RAW;
+    memcpy(&chunk[1], plain, rawLen);
+    *consumed = rawLen;
+    return rawLen + 1;
+}
+
+int32_t unpackChunk(const uint8_t *chunk, int32_t chunkLen, uint8_t *plain, int32_t plainCap)
+{
+    int32_t len = -1;
+
+    if (chunk == NULL || plain == NULL || chunkLen < 1)
+    {
+        fprintf(stderr, "Error: Invalid parameters for unpackChunk.\n");
+        return -1;
+    }
+    if (chunk[0] == CHUNK_RAW && chunkLen - 1 <= plainCap)
+    {
+        memcpy(plain, &chunk[1], chunkLen - 1);
+        len = chunkLen - 1;
+    }
+    else if (chunk[0] == CHUNK_LZ4)
+    {
+        len = lzDecompress(&chunk[1], chunkLen - 1, plain, plainCap);
+    }
+    if (len < 0)
+    {
+        fprintf(stderr, "Error: Malformed chunk of kind %u and %d bytes.\n", chunk[0], chunkLen);
+    }
+    return len;
+}
+
+// greedy single pass LZ4: one hash table probe per position, matches grown both ways. Stops when
+// the next sequence wouldn't fit in dstCap and ends the block with as many literals as still do
+static int32_t lzCompress(const uint8_t *src, int32_t srcLen, uint8_t *dst, int32_t dstCap, int32_t *consumed)
+{
+    uint16_t table[1 << LZ_HASH_LOG]; // input positions, srcLen is at most CODEC_MAX_IN
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;    // first byte not covered by a sequence yet
+    const uint8_t *end = src + srcLen;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dstCap;
+    int32_t litLen = 0;
+
+    memset(table, 0, sizeof(table));
+    while (srcLen > LZ_MF_LIMIT && ip < end - LZ_MF_LIMIT)
+    {
+        uint32_t seq = 0;
+        uint32_t ref32 = 0;
+        memcpy(&seq, ip, sizeof(seq));
+        uint32_t h = (seq * 2654435761U) >> (32 - LZ_HASH_LOG);
+        const uint8_t *ref = src + table[h];
+        table[h] = (uint16_t)(ip - src);
+        memcpy(&ref32, ref, sizeof(ref32));
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || ref32 != seq)
+        {
+            ip++;
+            continue;
+        }
+
+        const uint8_t *matchEnd = ip + LZ_MIN_MATCH;
+        const uint8_t *refEnd = ref + LZ_MIN_MATCH;
+        while (matchEnd < end - LZ_LAST_LITERALS && *matchEnd == *refEnd)
+        {
+            matchEnd++;
+            refEnd++;
+        }
+        while (ip > anchor && ref > src && ip[-1] == ref[-1])
+        {
+            ip--;
+            ref--;
+        }
+
+        // [token] [literal length] [literals] [offset (2 bytes)] [match length], one byte kept
+        // back for the final literals' token
+        litLen = ip - anchor;
+        int32_t matchLen = matchEnd - ip - LZ_MIN_MATCH;
+        if (1 + lenBytes(litLen) + litLen + 2 + lenBytes(matchLen) + 1 > oend - op)
+        {
+            break;
+        }
+        uint8_t *token = op++;
+        *token = (uint8_t)(((litLen < 15) ? litLen : 15) << 4);
+        op = putLen(op, litLen);
+        memcpy(op, anchor, litLen);
+        op += litLen;
+        op[0] = (uint8_t)((ip - ref) & 0xff);
+        op[1] = (uint8_t)((ip - ref) >> 8);
+        op += 2;
+        *token |= (uint8_t)((matchLen < 15) ? matchLen : 15);
+        op = putLen(op, matchLen);
+
+        anchor = ip = matchEnd;
+    }
+
+    if (oend - op < 1)
+    {
+        return -1;
+    }
+    litLen = end - anchor;
+    if (litLen > oend - op - 1)
+    {
+        litLen = oend - op - 1;
+    }
+    while (litLen > 0 && 1 + lenBytes(litLen) + litLen > oend - op)
+    {
+        litLen--;
+    }
+    *op++ = (uint8_t)(((litLen < 15) ? litLen : 15) << 4);
+    op = putLen(op, litLen);
+    memcpy(op, anchor, litLen);
+    op += litLen;
+
+    *consumed = (anchor - src) + litLen;
+    return op - dst;
+}
+
+// bounds checked on both sides, a chunk that passed the checksum but decodes past plainCap or
+// points before the start of the output is rejected instead of trusted
+static int32_t lzDecompress(const uint8_t *src, int32_t srcLen, uint8_t *dst, int32_t dstCap)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + srcLen;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dstCap;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+        int32_t len = token >> 4;
+        uint8_t more = 255;
+
+        while (len >= 15 && more == 255 && ip < iend)
+        {
+            more = *ip++;
+            len += more;
+        }
+        if (more == 255 && len >= 15)
+        {
+            return -1; // literal length ran off the end
+        }
+        if (len > iend - ip || len > oend - op)
+        {
+            return -1;
+        }
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)
+        {
+            break; // the last sequence is literals only
+        }
+
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+        int32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = token & 15;
+        more = 255;
+        while (len >= 15 && more == 255 && ip < iend)
+        {
+            more = *ip++;
+            len += more;
+        }
+        if (more == 255 && len >= 15)
+        {
+            return -1;
+        }
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - dst || len > oend - op)
+        {
+            return -1;
+        }
+
+        // an offset shorter than the match repeats the bytes it just wrote
+        const uint8_t *ref = op - offset;
+        if (offset >= len)
+        {
+            memcpy(op, ref, len);
+            op += len;
+        }
+        else
+        {
+            for (int32_t i = 0; i < len; i++)
+            {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return op - dst;
+}
+
+// bytes after the token a 4 bit length field of len needs
+static int32_t lenBytes(int32_t len)
+{
+    return (len < 15) ? 0 : (len - 15) / 255 + 1;
+}
+
+static uint8_t *putLen(uint8_t *op, int32_t len)
+{
+    if (len < 15)
+    {
+        return op;
+    }
+    for (len -= 15; len >= 255; len -= 255)
+    {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// func defs end
@@ -0,0 +1,29 @@
+// written by Lukas Shipley
+
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CODEC_NONE 0    // payloads go out as read from the file
+#define CODEC_LZ4 1     // each payload is one chunk, an LZ4 block or stored as is
+#define CODEC_MAX_IN (16 << 10) // most file bytes one chunk holds, rcopy's scratch for unpacking one
+
+#define CHUNK_RAW 0     // chunk kind byte: the rest is file data
+#define CHUNK_LZ4 1     // chunk kind byte: the rest is an LZ4 block
+
+int findCodec(const char *name); // CODEC_NONE/CODEC_LZ4 for "none"/"lz4", -1 if there is no such codec
+
+// packs the front of plain into one chunk [kind (1 byte)] [body] of at most chunkCap bytes: as
+// much of plain as compresses into it, or a stored prefix when compressing doesn't pay -
+// returns the chunk's length and how much of plain it took in *consumed, -1 on error
+int32_t packChunk(int codec, const uint8_t *plain, int32_t plainLen, uint8_t *chunk, int32_t chunkCap, int32_t *consumed);
+
+// the file bytes in one chunk, at most plainCap of them - returns their length or -1 if the
+// chunk is malformed or holds more than plainCap
+int32_t unpackChunk(const uint8_t *chunk, int32_t chunkLen, uint8_t *plain, int32_t plainCap);
+
+#endif
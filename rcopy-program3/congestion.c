@@ -0,0 +1,151 @@
+// Pluggable congestion control for the rcopy Project 3 Networks 464 class server
+
+#include "congestion.h"
+
+// fixed window - cwnd is always rcopy's winSize, the behavior before congestion control
+static void fixedInit(Congestion *cc);
+static void fixedAck(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample);
+static void fixedLoss(Congestion *cc, uint32_t lostSeqNum, uint32_t curr);
+static void fixedTimeout(Congestion *cc, uint32_t curr);
+
+// AIMD with slow start and NewReno style recovery, cwnd is counted in panes
+static void renoInit(Congestion *cc);
+static void renoAck(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample);
+static void renoLoss(Congestion *cc, uint32_t lostSeqNum, uint32_t curr);
+static void renoTimeout(Congestion *cc, uint32_t curr);
+
+static const CongestionOps fixedOps = {"none", fixedInit, fixedAck, fixedLoss, fixedTimeout};
+static const CongestionOps renoOps = {"newreno", renoInit, renoAck, renoLoss, renoTimeout};
+
+static const CongestionOps *algorithms[] = {&fixedOps, &renoOps};
+
+// func defs start
+
+// look an algorithm up by the name given on the server command line
+const CongestionOps *findCongestionOps(const char *name)
+{
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++)
+    {
+        if (strcmp(algorithms[i]->name, name) == 0)
+        {
+            return algorithms[i];
+        }
+    }
+    return NULL;
+}
+
+// setup a controller for one transfer, ops NULL means the fixed window
+void initCongestion(Congestion *cc, const CongestionOps *ops, uint32_t maxWin)
+{
+    memset(cc, 0, sizeof(Congestion));
+    cc->ops = (ops != NULL) ? ops : &fixedOps;
+    cc->maxWin = maxWin;
+    cc->ops->init(cc);
+}
+
+void ccAck(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample)
+{
+    cc->ops->onAck(cc, newlyAcked, lower, rttSample);
+}
+
+void ccLoss(Congestion *cc, uint32_t lostSeqNum, uint32_t curr)
+{
+    cc->ops->onLoss(cc, lostSeqNum, curr);
+}
+
+void ccTimeout(Congestion *cc, uint32_t curr)
+{
+    cc->ops->onTimeout(cc, curr);
+}
+
+// self explanatory
+uint32_t getCwnd(Congestion *cc)
+{
+    return cc->cwnd;
+}
+
+static void fixedInit(Congestion *cc)
+{
+    cc->cwnd = cc->maxWin;
+    cc->ssthresh = cc->maxWin;
+}
+
+static void fixedAck(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample)
+{
+}
+
+static void fixedLoss(Congestion *cc, uint32_t lostSeqNum, uint32_t curr)
+{
+}
+
+static void fixedTimeout(Congestion *cc, uint32_t curr)
+{
+}
+
+static void renoInit(Congestion *cc)
+{
+    cc->cwnd = (cc->maxWin < CC_INIT_WIN) ? cc->maxWin : CC_INIT_WIN;
+    cc->ssthresh = cc->maxWin;
+}
+
+// additive increase: a pane per ACKed pane in slow start, a pane per window of ACKs after that
+// nothing grows while recovering, a partial ACK just means the next hole is being resent
+static void renoAck(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample)
+{
+    if (cc->inRecovery)
+    {
+        if (lower < cc->recover)
+        {
+            return;
+        }
+        cc->inRecovery = 0; // everything outstanding at the loss is ACKed
+    }
+
+    if (cc->cwnd < cc->ssthresh)
+    {
+        cc->cwnd += newlyAcked;
+    }
+    else
+    {
+        cc->ackCount += newlyAcked;
+        while (cc->ackCount >= cc->cwnd)
+        {
+            cc->ackCount -= cc->cwnd;
+            cc->cwnd++;
+        }
+    }
+    if (cc->cwnd > cc->maxWin)
+    {
+        cc->cwnd = cc->maxWin;
+    }
+}
+
+// multiplicative decrease, once per window - holes reported again for panes sent before
+// the first cut are the same loss event
+static void renoLoss(Congestion *cc, uint32_t lostSeqNum, uint32_t curr)
+{
+    if (cc->inRecovery && lostSeqNum < cc->recover)
+    {
+        return;
+    }
+    cc->ssthresh = (cc->cwnd / 2 > CC_MIN_WIN) ? cc->cwnd / 2 : CC_MIN_WIN;
+    cc->cwnd = cc->ssthresh;
+    cc->ackCount = 0;
+    cc->recover = curr;
+    cc->inRecovery = 1;
+}
+
+// a timer ran out so the feedback loop itself broke down, start over from one pane
+static void renoTimeout(Congestion *cc, uint32_t curr)
+{
+    if (!cc->inRecovery || curr > cc->recover)
+    {
+        cc->ssthresh = (cc->cwnd / 2 > CC_MIN_WIN) ? cc->cwnd / 2 : CC_MIN_WIN;
+    }
+    cc->cwnd = 1;
+    cc->ackCount = 0;
+    cc->recover = curr;
+    cc->inRecovery = 1;
+}
+
+// func defs end
@@ -0,0 +1,46 @@
+// written by Lukas Shipley
+
+#ifndef __CONGESTION_H__
+#define __CONGESTION_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CC_INIT_WIN 10  // panes in the first flight (RFC 6928 initial window)
+#define CC_MIN_WIN 2    // never cut below this on a loss, a timeout can still drop to 1
+
+typedef struct congestion Congestion;
+
+// one congestion control algorithm - every hook gets the controller it updates, adding an
+// algorithm (CUBIC, BBR-like pacing) is a new CongestionOps and an entry in congestion.c's table
+typedef struct
+{
+    const char *name;
+    void (*init)(Congestion *cc);
+    void (*onAck)(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample); // lower = new lowest unACKed
+    void (*onLoss)(Congestion *cc, uint32_t lostSeqNum, uint32_t curr);  // SREJ/SACK reported a hole, curr = next new seqNum
+    void (*onTimeout)(Congestion *cc, uint32_t curr);                    // a pane timer expired
+} CongestionOps;
+
+struct congestion
+{
+    const CongestionOps *ops;
+    uint32_t maxWin;    // winSize from rcopy's FNAME, cwnd never goes past it
+    uint32_t cwnd;      // panes allowed in flight
+    uint32_t ssthresh;  // slow start below this, congestion avoidance above
+    uint32_t ackCount;  // panes ACKed since cwnd last grew in congestion avoidance
+    uint32_t recover;   // NewReno: in recovery until everything below this is ACKed
+    int inRecovery;
+};
+
+const CongestionOps *findCongestionOps(const char *name); // NULL if there is no such algorithm
+void initCongestion(Congestion *cc, const CongestionOps *ops, uint32_t maxWin);
+
+void ccAck(Congestion *cc, uint32_t newlyAcked, uint32_t lower, uint64_t rttSample);
+void ccLoss(Congestion *cc, uint32_t lostSeqNum, uint32_t curr);
+void ccTimeout(Congestion *cc, uint32_t curr);
+uint32_t getCwnd(Congestion *cc);
+
+#endif
@@ -20,7 +20,7 @@ unsigned short in_cksum(unsigned short *addr, int len);
 #endif
 
 /*
- * CPE464 Library - Hooks for the following: bind, select, send, sendto
+ * CPE464 Library - Hooks for the following: bind, select, send, sendto, sendmmsg, recvmmsg
  *
  * Identical usage as the original functions, but allows the grader to
  * check/change the actions the call does.
@@ -110,6 +110,25 @@ extern "C" {
     ssize_t recvfromErr(int s, void *buf, size_t len, int flags,
                         struct sockaddr *from, socklen_t *fromlen);
 
+    /*
+     * sendmmsgErr(...) - sendmmsg() with the same error events as sendtoErr(...)
+     *    run on every message of the batch. A message split over several iovecs
+     *    is gathered into one packet only when an event needs it. Dropped messages are reported as sent,
+     *    returns how many went out like sendmmsg() (fewer once a non-blocking socket fills up) or -1 on error.
+     *    (struct mmsghdr needs _GNU_SOURCE defined before any include)
+     */
+    struct mmsghdr;
+    int sendmmsgErr(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+    /*
+     * recvmmsgErr(...) - recvmmsg() that reports every message received like
+     *    recvfromErr(...). A message scattered over several iovecs is
+     *    gathered for the report, the data is left where it landed.
+     */
+    struct timespec;
+    int recvmmsgErr(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                    struct timespec *timeout);
+
     #define socket(...)	  socketMod(__VA_ARGS__)
 	#define bind(...)     bindMod(__VA_ARGS__)
     #define select(...)   selectMod(__VA_ARGS__)
@@ -117,10 +136,12 @@ extern "C" {
 
     #define send(...)     sendErr(__VA_ARGS__)
     #define sendto(...)   sendtoErr(__VA_ARGS__)
+    #define sendmmsg(...) sendmmsgErr(__VA_ARGS__)
 
 #ifdef CPE464_OVERRIDE_RECV
     #define recv(...)     recvErr(__VA_ARGS__)
     #define recvfrom(...) recvfromErr(__VA_ARGS__)
+    #define recvmmsg(...) recvmmsgErr(__VA_ARGS__)
 #endif
 
     #define sendtoErr_init(...) sendErr_init(__VA_ARGS__)
@@ -0,0 +1,273 @@
+// content defined chunking for the rcopy Project 3 Networks 464 class delta sync - both ends cut
+// a file into chunks where a rolling hash says so, so an edit only changes the chunks around it
+
+#include <endian.h>
+
+#include "delta.h"
+
+typedef struct
+{
+    uint8_t sig[SIG_LEN];
+    off_t offset;   // -1 = empty slot
+} IndexSlot;
+
+struct deltaIndex
+{
+    IndexSlot *slots;   // open addressing, kept at most half full
+    uint64_t mask;
+    uint64_t used;
+};
+
+static uint64_t gear[256]; // random value per byte for the rolling hash, the same on every host
+static int gearReady = 0;
+
+static uint64_t mix64(uint64_t z);
+static void initGear(void);
+static void sha256(const uint8_t *data, int32_t len, uint8_t *digest);
+static void sha256Block(uint32_t *state, const uint8_t *block);
+static IndexSlot *probe(DeltaIndex *index, const uint8_t *sig);
+static int growIndex(DeltaIndex *index);
+
+// func defs start
+
+// gear hash: shifted one bit per byte so it only remembers the last 64, hashing from 64 bytes
+// before the minimum gives the value it would have had from the start of the chunk
+int32_t cutChunk(const uint8_t *data, int32_t len)
+{
+    uint64_t hash = 0;
+    int32_t limit = (len < DELTA_MAX_CHUNK) ? len : DELTA_MAX_CHUNK;
+
+    if (data == NULL || limit <= DELTA_MIN_CHUNK)
+    {
+        return (limit > 0) ? limit : 0;
+    }
+    initGear();
+    for (int32_t i = DELTA_MIN_CHUNK - 64; i < limit; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (i >= DELTA_MIN_CHUNK && (hash >> (64 - DELTA_AVG_BITS)) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+// [length] [SHA-256 of the chunk], a chunk rcopy already has is only trusted when its hash is
+// one nobody can make collide
+void signChunk(const uint8_t *data, int32_t len, uint8_t *sig)
+{
+    uint32_t lenNet = htobe32((uint32_t)len);
+
+    memcpy(sig, &lenNet, sizeof(lenNet));
+    sha256(data, len, &sig[sizeof(lenNet)]);
+}
+
+uint32_t sigLength(const uint8_t *sig)
+{
+    uint32_t len = 0;
+    memcpy(&len, sig, sizeof(len));
+    return be32toh(len);
+}
+
+// chunks data the same way the server chunks its mapping, a chunk repeated in the file keeps
+// its first offset
+DeltaIndex *initDeltaIndex(const uint8_t *data, off_t len)
+{
+    uint8_t sig[SIG_LEN];
+    off_t offset = 0;
+
+    DeltaIndex *index = (DeltaIndex *)calloc(1, sizeof(DeltaIndex));
+    if (index == NULL || growIndex(index) < 0)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for the delta index.\n");
+        free(index);
+        return NULL;
+    }
+
+    while (offset < len)
+    {
+        int32_t chunkLen = cutChunk(&data[offset], (len - offset < DELTA_MAX_CHUNK) ? (int32_t)(len - offset) : DELTA_MAX_CHUNK);
+        signChunk(&data[offset], chunkLen, sig);
+        IndexSlot *slot = probe(index, sig);
+        if (slot->offset < 0)
+        {
+            memcpy(slot->sig, sig, SIG_LEN);
+            slot->offset = offset;
+            if (++index->used > index->mask / 2 && growIndex(index) < 0)
+            {
+                fprintf(stderr, "Error: Failed to grow the delta index.\n");
+                freeDeltaIndex(index);
+                return NULL;
+            }
+        }
+        offset += chunkLen;
+    }
+    return index;
+}
+
+void freeDeltaIndex(DeltaIndex *index)
+{
+    if (index == NULL)
+    {
+        return;
+    }
+    free(index->slots);
+    free(index);
+}
+
+off_t findChunk(DeltaIndex *index, const uint8_t *sig)
+{
+    if (index == NULL || sig == NULL)
+    {
+        fprintf(stderr, "Error: Invalid parameters for findChunk.\n");
+        return -1;
+    }
+    return probe(index, sig)->offset;
+}
+
+// the slot holding sig, or the empty one it would go in
+static IndexSlot *probe(DeltaIndex *index, const uint8_t *sig)
+{
+    uint64_t key = 0;
+
+    memcpy(&key, &sig[sizeof(uint32_t)], sizeof(key)); // any 8 bytes of a SHA-256 are well mixed
+    for (uint64_t i = key & index->mask;; i = (i + 1) & index->mask)
+    {
+        if (index->slots[i].offset < 0 || memcmp(index->slots[i].sig, sig, SIG_LEN) == 0)
+        {
+            return &index->slots[i];
+        }
+    }
+}
+
+// doubles the table (or starts it at 1024 slots) and moves every entry over - 0 or -1 on error
+static int growIndex(DeltaIndex *index)
+{
+    uint64_t oldSlots = (index->slots != NULL) ? index->mask + 1 : 0;
+    uint64_t newSlots = (oldSlots > 0) ? oldSlots * 2 : 1024;
+    IndexSlot *old = index->slots;
+
+    if ((index->slots = (IndexSlot *)malloc(newSlots * sizeof(IndexSlot))) == NULL)
+    {
+        index->slots = old;
+        return -1;
+    }
+    for (uint64_t i = 0; i < newSlots; i++)
+    {
+        index->slots[i].offset = -1;
+    }
+    index->mask = newSlots - 1;
+    for (uint64_t i = 0; i < oldSlots; i++)
+    {
+        if (old[i].offset >= 0)
+        {
+            *probe(index, old[i].sig) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// splitmix64's finalizer, every input bit reaches every output bit
+static uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void initGear(void)
+{
+    if (gearReady)
+    {
+        return;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        gear[i] = mix64(0x9e3779b97f4a7c15ULL * (uint64_t)(i + 1));
+    }
+    gearReady = 1;
+}
+
+// SHA-256 (FIPS 180-4) of len bytes into digest's 32 bytes
+static void sha256(const uint8_t *data, int32_t len, uint8_t *digest)
+{
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t tail[128] = {0};
+    uint64_t bits = htobe64((uint64_t)len * 8);
+    int32_t done = len - len % 64;
+    int32_t tailLen = 0;
+
+    for (int32_t i = 0; i < done; i += 64)
+    {
+        sha256Block(state, &data[i]);
+    }
+    // the last partial block, a 1 bit, zeros and the length in bits - one block or two
+    memcpy(tail, &data[done], len - done);
+    tail[len - done] = 0x80;
+    tailLen = (len - done < 56) ? 64 : 128;
+    memcpy(&tail[tailLen - sizeof(bits)], &bits, sizeof(bits));
+    for (int32_t i = 0; i < tailLen; i += 64)
+    {
+        sha256Block(state, &tail[i]);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        uint32_t word = htobe32(state[i]);
+        memcpy(&digest[4 * i], &word, sizeof(word));
+    }
+}
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Block(uint32_t *state, const uint8_t *block)
+{
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 16; i++)
+    {
+        memcpy(&w[i], &block[4 * i], sizeof(w[i]));
+        w[i] = be32toh(w[i]);
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+// func defs end
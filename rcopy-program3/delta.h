@@ -0,0 +1,32 @@
+// written by Lukas Shipley
+
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define DELTA_MIN_CHUNK (2 << 10)   // content defined chunks are at least this long
+#define DELTA_AVG_BITS 13           // a boundary every 2^13 bytes past the minimum on average
+#define DELTA_MAX_CHUNK (64 << 10)  // and cut here when no boundary shows up
+#define SIG_LEN 36  // one chunk's signature: [length (4 bytes)] [SHA-256 (32 bytes)], big-endian
+
+typedef struct deltaIndex DeltaIndex; // rcopy's old copy of the file, chunked and hashed
+
+// length of the chunk at the front of data: the first gear hash boundary past DELTA_MIN_CHUNK, or
+// DELTA_MAX_CHUNK, or all of len when it runs out first (the end of the file)
+int32_t cutChunk(const uint8_t *data, int32_t len);
+
+// the chunk's SIG_LEN signature into sig - its length and SHA-256, strong enough to trust a match
+void signChunk(const uint8_t *data, int32_t len, uint8_t *sig);
+uint32_t sigLength(const uint8_t *sig);
+
+// every chunk of data by its signature, NULL on error - data has to stay mapped while it's used
+DeltaIndex *initDeltaIndex(const uint8_t *data, off_t len);
+void freeDeltaIndex(DeltaIndex *index);
+off_t findChunk(DeltaIndex *index, const uint8_t *sig); // offset of a chunk with this signature, -1 = none
+
+#endif
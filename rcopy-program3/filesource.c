@@ -0,0 +1,450 @@
+// File data source for the rcopy Project 3 Networks 464 class server
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "filesource.h"
+
+static void readAhead(FileSource *src);
+static int refill(FileSource *src);
+static void prefetch(FileSource *src);
+static int32_t rangeLeft(FileSource *src);
+static int nextSpan(FileSource *src);
+static void onSigbus(int sig);
+
+static sigjmp_buf *busGuard = NULL; // where a SIGBUS goes, NULL = nothing reading a mapping
+
+// func defs start
+
+// regular, non-empty files are mapped whole with MADV_SEQUENTIAL so the kernel reads ahead of
+// the window, anything else (pipes, devices, empty files, mmap failing) uses buffered read()s.
+// A range (one stream of a multi-stream rcopy) starts at offset and stops length bytes later
+FileSource *initFileSource(int fd, off_t offset, off_t length)
+{
+    struct stat st;
+    FileSource *src = (FileSource *)calloc(1, sizeof(FileSource));
+    if (src == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for file source.\n");
+        return NULL;
+    }
+    src->fd = fd;
+    src->offset = (offset > 0) ? offset : 0;
+    src->end = (length >= 0 && length <= INT64_MAX - src->offset) ? src->offset + length : SOURCE_TO_EOF;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            src->map = (uint8_t *)map;
+            src->mapLen = st.st_size;
+            if (src->offset > src->mapLen) src->offset = src->mapLen;
+            if (src->end < 0 || src->end > src->mapLen) src->end = src->mapLen;
+            src->aheadTo = src->offset;
+            if (madvise(map, st.st_size, MADV_SEQUENTIAL) < 0)
+            {
+                perror("initFileSource, madvise"); // only a hint, the mapping still works
+            }
+            readAhead(src);
+            return src;
+        }
+        perror("initFileSource, mmap failed, using read()");
+    }
+
+    if (src->offset > 0 && lseek(fd, src->offset, SEEK_SET) < 0)
+    {
+        perror("initFileSource, lseek to range");
+        free(src);
+        return NULL;
+    }
+
+    src->readBuff = (uint8_t *)malloc(SOURCE_READ_LEN);
+    if (src->readBuff == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for file source read buffer.\n");
+        free(src);
+        return NULL;
+    }
+
+    // with IO_URING the next chunk is read while the window sends the current one
+    if ((src->ring = initUring(URING_ENTRIES)) != NULL)
+    {
+        if ((src->nextBuff = (uint8_t *)malloc(SOURCE_READ_LEN)) == NULL)
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for the second read buffer, using read().\n");
+            freeUring(src->ring);
+            src->ring = NULL;
+        }
+        else
+        {
+            prefetch(src);
+        }
+    }
+    return src;
+}
+
+// a delta's changed chunks: the first range is set up like initFileSource()'s, the others are
+// moved to one after another as each runs out
+FileSource *initFileSpans(int fd, const off_t *spans, int count)
+{
+    FileSource *src = NULL;
+
+    if (spans == NULL || count < 1)
+    {
+        fprintf(stderr, "Error: Invalid parameters for initFileSpans.\n");
+        return NULL;
+    }
+    if ((src = initFileSource(fd, spans[0], spans[1])) == NULL || count == 1)
+    {
+        return src;
+    }
+    if ((src->spans = (off_t *)malloc(2 * count * sizeof(off_t))) == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for file source ranges.\n");
+        freeFileSource(src);
+        return NULL;
+    }
+    memcpy(src->spans, spans, 2 * count * sizeof(off_t));
+    src->spanCount = count;
+    src->spanNext = 1;
+    return src;
+}
+
+// unmaps the file, the fd stays open for the caller to close
+void freeFileSource(FileSource *src)
+{
+    if (src == NULL)
+    {
+        return;
+    }
+    if (src->map != NULL)
+    {
+        munmap(src->map, src->mapLen);
+    }
+    freeUring(src->ring); // waits out a read still landing in nextBuff
+    free(src->nextBuff);
+    free(src->readBuff);
+    free(src->spans);
+    free(src);
+}
+
+// mapped files hand out slices of the mapping, which stay valid until freeFileSource() so panes
+// can send and resend straight out of them. The fallback refills its staging buffer with one
+// large read() and copies each packet's worth into copyTo since the buffer gets reused.
+// A mapped file shrinking mid transfer raises SIGBUS when a slice past the new end is read,
+// callers reading slices (checksums, sends) do it under guardSource().
+int32_t readSource(FileSource *src, uint8_t *copyTo, int32_t maxLen, const uint8_t **data)
+{
+    int32_t len = 0;
+
+    if (src == NULL || maxLen <= 0)
+    {
+        fprintf(stderr, "Error: Invalid parameters for readSource.\n");
+        return -1;
+    }
+    if (nextSpan(src) < 0)
+    {
+        return -1;
+    }
+
+    if (src->map != NULL)
+    {
+        len = (src->end - src->offset < maxLen) ? (int32_t)(src->end - src->offset) : maxLen;
+        *data = &src->map[src->offset];
+        src->offset += len;
+        readAhead(src);
+        return len;
+    }
+
+    if (src->readPos == src->readLen && refill(src) < 0)
+    {
+        src->readLen = 0;
+        src->readPos = 0;
+        return -1;
+    }
+    len = (src->readLen - src->readPos < maxLen) ? src->readLen - src->readPos : maxLen;
+    memcpy(copyTo, &src->readBuff[src->readPos], len);
+    src->readPos += len;
+    *data = copyTo;
+    return len;
+}
+
+// a chunk takes as much of the file as packs into maxLen, so only what it used is handed out -
+// the mapping is packed from in place, the fallback from its staging buffer
+int32_t readPacked(FileSource *src, int codec, uint8_t *copyTo, int32_t maxLen)
+{
+    int32_t avail = 0;
+    int32_t used = 0;
+    int32_t len = 0;
+
+    if (src == NULL || copyTo == NULL || maxLen <= 0)
+    {
+        fprintf(stderr, "Error: Invalid parameters for readPacked.\n");
+        return -1;
+    }
+    if (nextSpan(src) < 0)
+    {
+        return -1;
+    }
+
+    if (src->map != NULL)
+    {
+        avail = (src->end - src->offset < CODEC_MAX_IN) ? (int32_t)(src->end - src->offset) : CODEC_MAX_IN;
+        if (avail == 0)
+        {
+            return 0;
+        }
+        if ((len = packChunk(codec, &src->map[src->offset], avail, copyTo, maxLen, &used)) > 0)
+        {
+            src->offset += used;
+            readAhead(src);
+        }
+        return len;
+    }
+
+    if (src->readPos == src->readLen && refill(src) < 0)
+    {
+        src->readLen = 0;
+        src->readPos = 0;
+        return -1;
+    }
+    if (src->readPos == src->readLen)
+    {
+        return 0;
+    }
+    if ((len = packChunk(codec, &src->readBuff[src->readPos], src->readLen - src->readPos, copyTo, maxLen, &used)) > 0)
+    {
+        src->readPos += used;
+    }
+    return len;
+}
+
+// the mapping is chunked the way rcopy chunks its old copy, so an unchanged file signs the same.
+// The fallback chunks what's in its staging buffer, a chunk there can also end where a read()
+// did - that only costs matches, every signature still says exactly which bytes it covers
+int32_t readSigs(FileSource *src, uint8_t *copyTo, int32_t maxLen)
+{
+    const uint8_t *data = NULL;
+    int32_t avail = 0;
+    int32_t len = 0;
+
+    if (src == NULL || copyTo == NULL || maxLen < SIG_LEN)
+    {
+        fprintf(stderr, "Error: Invalid parameters for readSigs.\n");
+        return -1;
+    }
+    if (nextSpan(src) < 0)
+    {
+        return -1;
+    }
+
+    while (len + SIG_LEN <= maxLen)
+    {
+        if (src->map != NULL)
+        {
+            avail = (src->end - src->offset < DELTA_MAX_CHUNK) ? (int32_t)(src->end - src->offset) : DELTA_MAX_CHUNK;
+            data = &src->map[src->offset];
+        }
+        else
+        {
+            if (src->readPos == src->readLen && refill(src) < 0)
+            {
+                src->readLen = 0;
+                src->readPos = 0;
+                return -1;
+            }
+            avail = (src->readLen - src->readPos < DELTA_MAX_CHUNK) ? src->readLen - src->readPos : DELTA_MAX_CHUNK;
+            data = &src->readBuff[src->readPos];
+        }
+        if (avail == 0)
+        {
+            break;
+        }
+
+        int32_t chunkLen = cutChunk(data, avail);
+        signChunk(data, chunkLen, &copyTo[len]);
+        len += SIG_LEN;
+        if (src->map != NULL)
+        {
+            src->offset += chunkLen;
+        }
+        else
+        {
+            src->readPos += chunkLen;
+        }
+    }
+    if (src->map != NULL)
+    {
+        readAhead(src);
+    }
+    return len;
+}
+
+// the handler goes in the first time a guard is set, one sigaction for the whole process
+void guardSource(sigjmp_buf *guard)
+{
+    static int installed = 0;
+    struct sigaction sa;
+
+    if (guard != NULL && !installed)
+    {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = onSigbus;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGBUS, &sa, NULL) < 0)
+        {
+            perror("guardSource, sigaction");
+        }
+        installed = 1;
+    }
+    busGuard = guard;
+}
+
+// once the current range is all handed out, moves on to the next one that isn't empty - the
+// mapping just jumps, the fallback lseek()s and starts its reads over there - 0 or -1 on error
+static int nextSpan(FileSource *src)
+{
+    while (src->spanNext < src->spanCount &&
+           ((src->map != NULL) ? src->offset >= src->end : (src->readPos == src->readLen && !src->reading && rangeLeft(src) == 0)))
+    {
+        off_t offset = src->spans[2 * src->spanNext];
+        off_t length = src->spans[2 * src->spanNext + 1];
+        src->spanNext++;
+
+        if (src->map != NULL)
+        {
+            src->offset = (offset < src->mapLen) ? offset : src->mapLen;
+            src->end = (length < src->mapLen - src->offset) ? src->offset + length : src->mapLen;
+            src->aheadTo = src->offset;
+            readAhead(src);
+            continue;
+        }
+        if (lseek(src->fd, offset, SEEK_SET) < 0)
+        {
+            perror("readSource, lseek to next range");
+            return -1;
+        }
+        src->offset = offset;
+        src->end = (length <= INT64_MAX - offset) ? offset + length : SOURCE_TO_EOF;
+        src->readLen = 0;
+        src->readPos = 0;
+        if (src->ring != NULL)
+        {
+            prefetch(src);
+        }
+    }
+    return 0;
+}
+
+// next SOURCE_READ_LEN bytes into readBuff, with a ring that's the read prefetch() started on the
+// last refill so the disk only stalls the sender when it falls behind the network - 0 or -1 on error
+static int refill(FileSource *src)
+{
+    uint64_t tag = 0;
+    int32_t res = 0;
+    uint8_t *done = src->readBuff;
+
+    src->readPos = 0;
+    if (src->ring == NULL)
+    {
+        src->readLen = (rangeLeft(src) > 0) ? read(src->fd, src->readBuff, rangeLeft(src)) : 0;
+        if (src->readLen < 0)
+        {
+            return -1;
+        }
+        src->offset += src->readLen;
+        return 0;
+    }
+    if (!src->reading)
+    {
+        src->readLen = 0; // EOF came back already
+        return 0;
+    }
+
+    src->reading = 0;
+    if (uringWait(src->ring, &tag, &res) < 0)
+    {
+        return -1;
+    }
+    if (res < 0)
+    {
+        errno = -res;
+        perror("readSource, io_uring read");
+        return -1;
+    }
+    src->readBuff = src->nextBuff;
+    src->nextBuff = done;
+    src->readLen = res;
+    src->offset += res;
+    if (res > 0)
+    {
+        prefetch(src);
+    }
+    return 0;
+}
+
+// bytes the fallback may read next, SOURCE_READ_LEN or what's left of the range
+static int32_t rangeLeft(FileSource *src)
+{
+    if (src->end >= 0 && src->end - src->offset < SOURCE_READ_LEN)
+    {
+        return (int32_t)(src->end - src->offset);
+    }
+    return SOURCE_READ_LEN;
+}
+
+// starts the read of the next chunk into nextBuff, at the file position so pipes work too -
+// if it can't be queued the ring is dropped and refill() goes back to plain read()s
+static void prefetch(FileSource *src)
+{
+    if (rangeLeft(src) == 0)
+    {
+        return; // end of the range, refill() reports EOF
+    }
+    if (uringRead(src->ring, src->fd, src->nextBuff, rangeLeft(src), URING_CUR_POS, 0) < 0)
+    {
+        freeUring(src->ring);
+        src->ring = NULL;
+        return;
+    }
+    src->reading = 1;
+}
+
+// readahead ring for the mapping: once less than half of READAHEAD_LEN is left paged in ahead of
+// the window's next byte, ask for the next half so the disk stays a few MB ahead of the sender
+static void readAhead(FileSource *src)
+{
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    off_t start = 0;
+    off_t end = 0;
+
+    if (READAHEAD_LEN <= 0 || src->aheadTo >= src->end || src->aheadTo - src->offset > READAHEAD_LEN / 2)
+    {
+        return;
+    }
+    start = (src->aheadTo > src->offset) ? src->aheadTo : src->offset;
+    start -= start % pageSize; // madvise() wants a page aligned address
+    end = (src->offset + READAHEAD_LEN < src->end) ? src->offset + READAHEAD_LEN : src->end;
+    if (madvise(&src->map[start], end - start, MADV_WILLNEED) < 0)
+    {
+        perror("readAhead, madvise");
+    }
+    src->aheadTo = end;
+}
+
+// a SIGBUS outside a guard is a real bug, it gets the default action
+static void onSigbus(int sig)
+{
+    if (busGuard != NULL)
+    {
+        siglongjmp(*busGuard, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// func defs end
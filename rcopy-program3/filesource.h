@@ -0,0 +1,65 @@
+// written by Lukas Shipley
+
+#ifndef __FILESOURCE_H__
+#define __FILESOURCE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <setjmp.h>
+
+#include "uring.h"
+#include "codec.h"
+#include "delta.h"
+
+#ifndef READAHEAD_LEN
+#define READAHEAD_LEN (4 << 20) // bytes kept paged in ahead of the window, 0 = leave it to MADV_SEQUENTIAL
+#endif
+#define SOURCE_READ_LEN ((READAHEAD_LEN > (1 << 16)) ? READAHEAD_LEN : (1 << 16)) // fallback read() size, at least 64 KiB
+
+typedef struct
+{
+    int fd;
+    uint8_t *map;       // whole file mapped read-only, NULL = buffered read() fallback
+    off_t mapLen;
+    off_t offset;       // next byte of the mapping to hand out, or the fallback's next byte to read()
+    off_t end;          // stop here (end of the requested range), -1 = at EOF
+    off_t aheadTo;      // MADV_WILLNEED has been asked for up to here
+    uint8_t *readBuff;  // fallback staging buffer, SOURCE_READ_LEN bytes
+    int32_t readLen;    // bytes currently in readBuff
+    int32_t readPos;    // next byte of readBuff to hand out
+    Uring *ring;        // IO_URING: the next read is already in flight into nextBuff, NULL = read()
+    uint8_t *nextBuff;  // IO_URING: second staging buffer, swapped with readBuff when it's used up
+    int reading;        // IO_URING: a read into nextBuff is in flight
+    off_t *spans;       // more ranges to hand out once this one is done, [offset, length] pairs
+    int spanCount;      // pairs in spans
+    int spanNext;       // next pair to move to
+} FileSource; // where the server's file data comes from, one per session
+
+#define SOURCE_TO_EOF -1 // initFileSource() length for the rest of the file
+
+// mmap()s regular files, falls back to large (io_uring) read()s - only the length bytes from
+// offset on are handed out (clamped to the file), NULL on error or an unseekable offset
+FileSource *initFileSource(int fd, off_t offset, off_t length);
+FileSource *initFileSpans(int fd, const off_t *spans, int count); // count [offset, length] ranges back to back
+void freeFileSource(FileSource *src);
+
+// next maxLen bytes or less of the file: *data points into the mapping (no copy), or at
+// copyTo after copying them out of the staging buffer - returns the length, 0 at EOF, -1 on error
+int32_t readSource(FileSource *src, uint8_t *copyTo, int32_t maxLen, const uint8_t **data);
+
+// the same bytes readSource() would hand out next, packed into one codec chunk of at most maxLen
+// bytes at copyTo - returns the chunk's length, 0 at EOF, -1 on error
+int32_t readPacked(FileSource *src, int codec, uint8_t *copyTo, int32_t maxLen);
+
+// SIG_LEN signatures of the next content defined chunks instead of their bytes, as many as fit
+// in maxLen at copyTo - returns their length, 0 at EOF, -1 on error
+int32_t readSigs(FileSource *src, uint8_t *copyTo, int32_t maxLen);
+
+// a mapped file cut short under the server raises SIGBUS on the next read past its new end,
+// while guard is set that siglongjmp()s to it instead of killing every session - NULL disarms it
+void guardSource(sigjmp_buf *guard);
+
+#endif
@@ -19,6 +19,14 @@ extern "C" {
 #ifdef sendto
     #undef sendto
 #endif
+
+#ifdef sendmmsg
+    #undef sendmmsg
+#endif
+
+#ifdef recvmmsg
+    #undef recvmmsg
+#endif
 // ============================================================================
 #include <stdint.h>
 #include <stdio.h>
@@ -29,6 +37,7 @@ extern "C" {
 #include <sys/socket.h>
 
 #include <string.h>
+#include <errno.h>
 
 #include <arpa/inet.h>
 // ============================================================================
@@ -129,7 +138,31 @@ int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pL
     return hasChanged;
 }
 // ============================================================================
-int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
+void PacketManager::takeCopy(void** pBuf, size_t len, void* pCopy, const struct iovec* pIov, size_t iovCnt)
+{
+    if (pCopy == NULL || *pBuf == pCopy)
+    {
+        return;
+    }
+
+    if (pIov == NULL)
+    {
+        memcpy(pCopy, *pBuf, len);
+    }
+    else
+    {
+        size_t offset = 0;
+        for (size_t i = 0; i < iovCnt; ++i)
+        {
+            memcpy((unsigned char*)pCopy + offset, pIov[i].iov_base, pIov[i].iov_len);
+            offset += pIov[i].iov_len;
+        }
+    }
+    *pBuf = pCopy;
+}
+// ============================================================================
+int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo, void* pCopy,
+                                 const struct iovec* pIov, size_t iovCnt)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -141,6 +174,8 @@ int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
     bool hasChanged = false;
     bool hasDropped = false;
 
+    // Standard events (seqNo info, drops by message number) only read the header,
+    // they run on the caller's buffer as is
     nResult = runMsgEvents(m_ErrorCase_Constant, pBuf, pLen, msgNo);
     if (nResult < 0)
     {
@@ -162,6 +197,9 @@ int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
   {
 	  // Chose which one to run
 	  int randCase = (int)((float)m_ErrorCase_Chance.size() * drand48());
+
+	  // Random events may flip bits, never let them touch the caller's buffer
+	  takeCopy(pBuf, *pLen, pCopy, pIov, iovCnt);
 	  nResult = m_ErrorCase_Chance[randCase]->run(pBuf, pLen, msgNo);
 	  if (nResult < 0)
 	  {
@@ -211,12 +249,12 @@ ssize_t PacketManager::send_Err(int s, void *buf, size_t len, int flags)
     MSG_PRINT("MSG# %3u SEQ# %3u LEN %4u FLAG %2d ", m_MsgNo, seqNo, len, packetFlags); 
     printType(packetFlags, (char *)buf);
 	
+    // bufTmp is only filled if an error event fires, clean messages go out of buf as is
     size_t lenTmp = len;
     unsigned char bufTmp[len];
-    memcpy(bufTmp, buf, lenTmp);
-    void* pBuf = bufTmp;
+    void* pBuf = buf;
 
-    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo, bufTmp);
     // Error Case
     if (nResult < 0)
     {
@@ -225,7 +263,7 @@ ssize_t PacketManager::send_Err(int s, void *buf, size_t len, int flags)
     // (Non-)changed Cases
     else if ((nResult == 0) || (nResult == 1))
     {
-        ssize_t lenSent = send(s, bufTmp, lenTmp, flags);
+        ssize_t lenSent = send(s, pBuf, lenTmp, flags);
         if (lenSent == (ssize_t)lenTmp)
         {
             nResult = len;
@@ -373,12 +411,12 @@ ssize_t PacketManager::sendto_Err(int s, void *buf, size_t len, int flags,
     MSG_PRINT("SEND MSG# %3u SEQ# %3u LEN %4u FLAGS %2d ", m_MsgNo, seqNo, len, packetFlags); 
  	printType(packetFlags, (char *)buf);  
 	
+    // bufTmp is only filled if an error event fires, clean messages go out of buf as is
     size_t lenTmp = len;
     unsigned char bufTmp[len];
-    memcpy(bufTmp, buf, lenTmp);
-    void* pBuf = bufTmp;
+    void* pBuf = buf;
 
-    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo, bufTmp);
     		
 
 	MSG_PRINT("\n");
@@ -407,6 +445,124 @@ ssize_t PacketManager::sendto_Err(int s, void *buf, size_t len, int flags,
     return -1;
 }
 // ============================================================================
+int PacketManager::sendmmsg_Err(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+    int nResult = 0;
+
+    if (msgvec == NULL)
+    {
+        ERR_PRINT("msgvec pointer == NULL\n");
+        exit(1);
+    }
+
+    // One scratch block for the whole batch - a message's slice is only written
+    // if an error event fires on it, the rest go out of the caller's buffers.
+    // Messages split over several iovecs (header + payload) are only gathered
+    // into their slice when an event needs the whole packet in one piece.
+    size_t totalLen = 0;
+    for (unsigned int i = 0; i < vlen; ++i)
+    {
+        for (size_t j = 0; j < msgvec[i].msg_hdr.msg_iovlen; ++j)
+        {
+            totalLen += msgvec[i].msg_hdr.msg_iov[j].iov_len;
+        }
+    }
+
+    unsigned char* bufTmp = new unsigned char[totalLen + 1];
+    struct mmsghdr* sendVec = new struct mmsghdr[vlen + 1];
+    struct iovec* sendIov = new struct iovec[vlen + 1];
+    unsigned int* sendIdx = new unsigned int[vlen + 1];    // msgvec index of each sendVec entry
+    unsigned int sendCnt = 0;
+    unsigned int doneCnt = 0;
+    size_t offset = 0;
+
+    for (unsigned int i = 0; i < vlen; ++i)
+    {
+        struct iovec* iov = msgvec[i].msg_hdr.msg_iov;
+        size_t iovCnt = msgvec[i].msg_hdr.msg_iovlen;
+        void* buf = iov[0].iov_base;
+        size_t len = 0;
+
+        for (size_t j = 0; j < iovCnt; ++j)
+        {
+            len += iov[j].iov_len;
+        }
+
+        // the header is always whole in the first iovec
+        if (buf == NULL || len == 0 || iov[0].iov_len < 7)
+        {
+            ERR_PRINT("buf pointer == NULL, len == 0 or a split header in message %u\n", i);
+            exit(1);
+        }
+
+        ++m_MsgNo;
+
+        uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+        uint8_t packetFlags = ((char *) buf)[6];
+        MSG_PRINT("SEND MSG# %3u SEQ# %3u LEN %4u FLAGS %2d ", m_MsgNo, seqNo, len, packetFlags);
+        printType(packetFlags, (char *)buf);
+
+        size_t lenTmp = len;
+        void* pBuf = buf;
+
+        nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo, &bufTmp[offset],
+                                (iovCnt > 1) ? iov : NULL, iovCnt);
+        offset += len;
+
+        MSG_PRINT("\n");
+        if (nResult < 0)
+        {
+            ERR_PRINT("prcoessEvents\n");
+            break;
+        }
+        else if ((nResult == 0) || (nResult == 1))
+        {
+            sendVec[sendCnt].msg_hdr = msgvec[i].msg_hdr;
+            sendVec[sendCnt].msg_len = 0;
+            if (pBuf != buf || lenTmp != len)
+            {
+                // an event changed it, the copy goes out instead
+                sendIov[sendCnt].iov_base = pBuf;
+                sendIov[sendCnt].iov_len = lenTmp;
+                sendVec[sendCnt].msg_hdr.msg_iov = &sendIov[sendCnt];
+                sendVec[sendCnt].msg_hdr.msg_iovlen = 1;
+            }
+            sendIdx[sendCnt] = i;
+            ++sendCnt;
+        }
+        // Drop Case - never reaches the wire but counts as sent
+
+        msgvec[i].msg_len = len;
+        ++doneCnt;
+    }
+
+    // One sendmmsg() like the caller's. It stops short when a non-blocking socket's buffer is
+    // full, the count returned then ends at the first message that didn't go out (dropped ones
+    // before it count as sent), so the caller can resend the rest like any lost packet.
+    int returnValue = (nResult < 0) ? -1 : (int)doneCnt;
+    if (nResult >= 0 && sendCnt > 0)
+    {
+        int numSent = sendmmsg(s, sendVec, sendCnt, flags);
+        if (numSent < 0 && sendIdx[0] == 0)
+        {
+            returnValue = -1;
+        }
+        else if (numSent < (int)sendCnt)
+        {
+            returnValue = (int)sendIdx[(numSent < 0) ? 0 : numSent];
+        }
+    }
+    int sendErrno = errno;
+
+    delete[] sendIdx;
+    delete[] sendIov;
+    delete[] sendVec;
+    delete[] bufTmp;
+
+    errno = sendErrno;
+    return returnValue;
+}
+// ============================================================================
 ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
                    struct sockaddr *from, socklen_t *fromlen)
 {
@@ -428,4 +584,49 @@ ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
     return ret;
 }
 // ============================================================================
+int PacketManager::recvmmsg_Mod(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                                struct timespec *timeout)
+{
+    int ret = ::recvmmsg(s, msgvec, vlen, flags, timeout);
+
+    for (int i = 0; i < ret; ++i)
+    {
+        char* buf = (char *)msgvec[i].msg_hdr.msg_iov[0].iov_base;
+        unsigned int len = msgvec[i].msg_len;
+
+        // a message scattered over several iovecs (header + payload slot) is
+        // gathered so the report and checksum see the whole packet
+        char gathered[len + 1];
+        if (msgvec[i].msg_hdr.msg_iovlen > 1)
+        {
+            unsigned int done = 0;
+            for (size_t j = 0; j < msgvec[i].msg_hdr.msg_iovlen && done < len; ++j)
+            {
+                size_t part = msgvec[i].msg_hdr.msg_iov[j].iov_len;
+                if (part > len - done)
+                {
+                    part = len - done;
+                }
+                memcpy(&gathered[done], msgvec[i].msg_hdr.msg_iov[j].iov_base, part);
+                done += part;
+            }
+            buf = gathered;
+        }
+
+        uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+        uint8_t packetFlags = buf[6];
+        MSG_PRINT("RECV          SEQ# %3u LEN %4u FLAGS %2d ", seqNo, len, packetFlags);
+        printType(packetFlags, buf);
+
+        if (in_cksum((unsigned short *) buf, len) != 0)
+        {
+            MSG_PRINT(" - RECV Corrupted packet");
+        }
+
+        MSG_PRINT("\n");
+    }
+
+    return ret;
+}
+// ============================================================================
 // ============================================================================
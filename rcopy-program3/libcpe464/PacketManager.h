@@ -18,6 +18,7 @@
 #include "MsgEvents/IMsgEvent.h"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <vector>
 
 class PacketManager
@@ -34,7 +35,11 @@ class PacketManager
     int addMsgEvent_Standard(IMsgEvent* errorCase);
     int addMsgEvent_Random(IMsgEvent* errorCase);
 
-    int processEvents(void** pBuf, size_t* pLen, uint32_t msgNo);
+    // pCopy (len bytes) receives a private copy of *pBuf before any event that may
+    // change it runs, so the caller's buffer is only copied when it has to be. A
+    // packet split over iovCnt iovecs (pIov) is gathered into pCopy the same way
+    int processEvents(void** pBuf, size_t* pLen, uint32_t msgNo, void* pCopy = NULL,
+                      const struct iovec* pIov = NULL, size_t iovCnt = 0);
 	
 	void printType(int flag, char * buf);
 	
@@ -45,9 +50,14 @@ class PacketManager
     ssize_t sendto_Err(int s, void *buf, size_t len, int flags,
                    const struct sockaddr *to, socklen_t tolen);
 
+    int sendmmsg_Err(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
     ssize_t recvfrom_Mod(int s, void *buf, size_t len, int flags,
                     struct sockaddr *from, socklen_t *fromlen);
 
+    int recvmmsg_Mod(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                     struct timespec *timeout);
+
   private:
     float      m_ErrorRate;
     uint32_t   m_MsgNo;
@@ -57,6 +67,8 @@ class PacketManager
   
     int runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo);
 
+    void takeCopy(void** pBuf, size_t len, void* pCopy, const struct iovec* pIov, size_t iovCnt);
+
     int clearMsgEvents(listMsgEvents_t& ErrVec);
 };
 
@@ -16,6 +16,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <strings.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -24,10 +25,13 @@
 #include "cpe464.h"
 #include "gethostbyname.h"
 
+#ifndef DEBUG_FLAG
 #define DEBUG_FLAG 1 // ~!*
+#endif
 
 #define LISTEN_BACKLOG 10
 #define MAX_FNAME_LEN 101   // including null terminator
+#define MMSG_BATCH 64       // most packets one sendmmsg() call carries, its arrays are on the stack
 
 typedef struct connection
 {
@@ -63,6 +67,8 @@ int udpClientSetup(char * hostName, int serverPort, Connection * connection);
 // int setupUdpClientToServer(struct sockaddr_in6 *serverAddress, char * hostName, int serverPort);
 int selectCall(int32_t sockNum, int32_t sec, int32_t usec);
 int safeSendTo(uint8_t * buff, int len, Connection * to);
+int safeSendMmsgSplit(uint8_t ** heads, int headLen, uint8_t ** bodies, int * bodyLens, int count, Connection * to);
 int safeRecvFrom(int recvSockNum, uint8_t * buff, int len, Connection * from);
+int safeRecvMmsgSplit(int recvSockNum, uint8_t ** heads, int headLen, uint8_t ** bodies, int bodyLen, int * lens, int count, Connection * from);
 
 #endif
@@ -0,0 +1,75 @@
+// Token bucket packet pacer for the rcopy Project 3 Networks 464 class server
+
+#include "pacer.h"
+
+// func defs start
+
+// start with a full bucket so the first burst isn't held back
+void initPacer(Pacer *pacer, uint64_t rate)
+{
+    pacer->rate = rate;
+    pacer->tokens = (uint64_t)PACE_BURST * PACE_UNIT;
+    pacer->lastFill = 0;
+}
+
+void setPacingRate(Pacer *pacer, uint64_t rate)
+{
+    pacer->rate = rate;
+}
+
+// cwnd panes spread over one SRTT, scaled by the gain so the pacer never becomes the bottleneck
+uint64_t derivePacingRate(uint32_t cwnd, uint64_t srtt, int slowStart)
+{
+    if (srtt == 0)
+    {
+        return 0; // no RTT sample yet, nothing to pace against
+    }
+    return (uint64_t)cwnd * 1000000 * (slowStart ? PACE_GAIN_SS : PACE_GAIN_CA) / 100 / srtt + 1;
+}
+
+// refill rate tokens per second up to PACE_BURST packets, then hand out whole packets
+uint32_t pacerAllowance(Pacer *pacer, uint64_t now)
+{
+    uint64_t full = (uint64_t)PACE_BURST * PACE_UNIT;
+
+    if (pacer->rate == 0)
+    {
+        pacer->tokens = full;
+        pacer->lastFill = now;
+        return UINT32_MAX;
+    }
+    if (now > pacer->lastFill)
+    {
+        uint64_t elapsed = now - pacer->lastFill;
+        if (elapsed > PACE_UNIT)
+        {
+            elapsed = PACE_UNIT; // a second idle fills any bucket, and keeps the product from overflowing
+        }
+        pacer->tokens += elapsed * pacer->rate;
+        if (pacer->tokens > full)
+        {
+            pacer->tokens = full;
+        }
+    }
+    pacer->lastFill = now;
+    return pacer->tokens / PACE_UNIT;
+}
+
+void pacerConsume(Pacer *pacer, uint32_t count)
+{
+    uint64_t cost = (uint64_t)count * PACE_UNIT;
+
+    pacer->tokens = (cost > pacer->tokens) ? 0 : pacer->tokens - cost;
+}
+
+// time the bucket holds a whole packet again, from the last refill
+uint64_t pacerNextSend(Pacer *pacer)
+{
+    if (pacer->rate == 0 || pacer->tokens >= PACE_UNIT)
+    {
+        return 0;
+    }
+    return pacer->lastFill + (PACE_UNIT - pacer->tokens + pacer->rate - 1) / pacer->rate;
+}
+
+// func defs end
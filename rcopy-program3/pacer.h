@@ -0,0 +1,31 @@
+// written by Lukas Shipley
+
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define PACE_OFF 0      // paceRate: send the whole open window at once like before
+#define PACE_AUTO -1    // paceRate: derive the rate from cwnd / SRTT
+#define PACE_BURST 8    // bucket depth in packets, most that go out back to back
+#define PACE_GAIN_SS 200    // percent of cwnd/SRTT to pace at in slow start (same gains as Linux fq pacing)
+#define PACE_GAIN_CA 120    // percent of cwnd/SRTT to pace at in congestion avoidance
+#define PACE_UNIT 1000000   // tokens per packet, tokens are packet-microseconds so the refill stays integer
+
+typedef struct
+{
+    uint64_t rate;      // packets per second, 0 = unpaced
+    uint64_t tokens;    // PACE_UNIT per packet that may go out now
+    uint64_t lastFill;  // monotonic us of the last refill
+} Pacer; // token bucket in front of the burst send, one per session
+
+void initPacer(Pacer *pacer, uint64_t rate);
+void setPacingRate(Pacer *pacer, uint64_t rate);
+uint64_t derivePacingRate(uint32_t cwnd, uint64_t srtt, int slowStart); // packets/s for cwnd panes per SRTT, 0 = no sample yet
+uint32_t pacerAllowance(Pacer *pacer, uint64_t now);    // packets that may be sent right now
+void pacerConsume(Pacer *pacer, uint32_t count);
+uint64_t pacerNextSend(Pacer *pacer);   // monotonic us the next packet may go out, 0 = now
+
+#endif
@@ -2,6 +2,8 @@
 // By Hugh Smith	4/1/2017
 // Modified by Lukas Shipley on 5/23/2025
 
+#define _GNU_SOURCE // tdestroy()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -15,6 +17,11 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <endian.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <search.h>
 
 #include "gethostbyname.h"
 #include "networks.h"
@@ -24,9 +31,16 @@
 #include "pollLib.h"
 #include "srej.h"
 #include "buffer.h"
+#include "delta.h"
 
 #define MAX_PACK_LEN 1500
 #define MAX_PAYLOAD 1400
+#define MAX_STREAMS 16  // most concurrent range transfers one rcopy runs
+#define RESUME_SUFFIX ".resume"     // checkpoint next to the output file: [byte offset] [source name]
+#define CHECKPOINT_LEN (16 << 20)   // bytes written between checkpoints
+#define MAX_BATCH (MAX_PAYLOAD / 2)  // most names one FNAME_LIST can carry, one character and a '\n' each
+#define SIGS_SUFFIX ".sigs"     // delta sync: the server's chunk signatures
+#define SPILL_SUFFIX ".delta"   // delta sync: the changed chunks' bytes, back to back
 
 typedef enum State STATE;
 
@@ -39,59 +53,168 @@ enum State
     DONE
 };
 
-void transferFile(char *argv[]);
-STATE start_state(char **argv, Connection *server, uint32_t *expectedSeqNum, uint32_t winSize, int32_t buffSize);
-STATE fnameRecv(char *fname, Connection *server);
-STATE recvData(int32_t outFile, Connection *server, uint32_t *expectedSeqNum);
-STATE file_ok(int *outFileFd, char *outFileName, uint32_t winSize, int32_t buffSize);
-void checkArgs(int argc, char *argv[], float *errorRate);
+// the part of the source one transfer covers
+typedef struct
+{
+    int ranged;         // 0 = whole file with a plain FNAME, 1 = only length bytes from offset
+    uint64_t offset;    // first byte of the source covered, also where it's written in the output
+    uint64_t length;
+    int keepFile;       // 1 = open the output without truncating it, other streams are writing it too
+    uint64_t fileSize;  // from FNAME_OK, 0 = not reported
+    int checkpoint;     // 1 = keep <dst>.resume up to date so a failed copy picks up where it stopped
+    int codec;          // CODEC_NONE, or the server packs the data with it
+    int sigs;           // 1 = ask for the source's chunk signatures (FNAME_SIGS) instead of its bytes
+    uint64_t *spans;    // a delta's changed chunks, [offset, length] pairs sent in place of the one range
+    int spanCount;      // and written back to back from offset
+} Range;
+
+// the manifest entries sent in one FNAME_LIST, they come back through one session
+typedef struct
+{
+    char list[MAX_PAYLOAD];     // source names, each ending in '\0' - sent with '\n' between them
+    int listLen;
+    char *names[MAX_BATCH];     // each entry's name in list
+    int count;
+    char *outDir;               // entries are written to outDir/<name's last component>
+    int outFileFd;              // file the last NEXT_FILE opened, -1 = none
+    int failed;                 // the server skipped an entry it couldn't open
+} Batch;
+
+// a delta sync's inputs, all mapped read-only
+typedef struct
+{
+    uint8_t *old;       // the old copy at the destination
+    off_t oldLen;
+    uint8_t *sigs;      // the source's chunk signatures, SIG_LEN each
+    off_t sigsLen;
+    uint8_t *spill;     // the fetched chunks back to back
+    off_t spillLen;
+    off_t *matches;     // per signature: the chunk's offset in old, -1 = fetched
+    uint64_t *spans;    // the fetched chunks as [offset, length] ranges of the source
+    int spanCount;
+} Delta;
+
+int transferFile(char *argv[], Range *range, Batch *batch);
+int transferManifest(char *argv[], int codec);
+int nextOutput(PacketBuffer *pb, Batch *batch, uint8_t *payload, int32_t len);
+char *outputName(char *name);
+int compareNames(const void *a, const void *b);
+int transferStreams(char *argv[], int streams, int codec);
+int transferDelta(char *argv[], int codec);
+int planDelta(Delta *delta, char *outFileName);
+void freeDelta(Delta *delta);
+int fetchSpans(char *argv[], char *spillPath, uint64_t *spans, int spanCount, int codec);
+int buildDelta(int outFd, Delta *delta);
+int mapFile(char *path, uint8_t **data, off_t *len);
+int writeOut(int fd, const uint8_t *data, off_t len);
+off_t loadCheckpoint(char *srcName, char *outFileName);
+int saveCheckpoint(PacketBuffer *pb, char *srcName, char *outFileName);
+void clearCheckpoint(char *outFileName);
+STATE start_state(char **argv, Connection *server, uint32_t *expectedSeqNum, uint32_t winSize, int32_t buffSize, Range *range, Batch *batch);
+STATE fnameRecv(char *fname, Connection *server, RttEstimator *rtt, Range *range);
+STATE recvData(PacketBuffer *pb, Connection *server, uint32_t *expectedSeqNum, uint32_t *eofSeqNum, Batch *batch);
+STATE file_ok(int *outFileFd, char *outFileName, uint32_t winSize, int32_t buffSize, PacketBuffer **pb, Range *range, Batch *batch);
+void checkArgs(int argc, char *argv[], float *errorRate, int *streams, int *codec, int *delta);
 
 int main(int argc, char *argv[])
 {
     // int socketNum = 0;
     // struct sockaddr_in6 server;		// Supports 4 and 6 but requires IPv6 struct
     float errorRate = 0;
+    int streams = 1;
+    int codec = CODEC_NONE;
+    int delta = 0;
+    Range whole = {0};
+    off_t resumeOffset = 0;
+    int status = 0;
+    struct stat st;
 
-    checkArgs(argc, argv, &errorRate);
+    checkArgs(argc, argv, &errorRate, &streams, &codec, &delta);
 
     // socketNum = setupUdpClientToServer(&server, argv[2], portNumber);
 
     sendtoErr_init(errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON); // TODO: turn RSEED_ON for turn in
 
-    transferFile(argv);
+    if (argv[1][0] == '@')
+    {
+        status = (transferManifest(argv, codec) < 0) ? 1 : 0;
+    }
+    else if (delta && stat(argv[2], &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        // only worth it against an old copy, without one it's the usual full transfer below
+        status = (transferDelta(argv, codec) < 0) ? 1 : 0;
+    }
+    else if (streams == 1)
+    {
+        // a copy that failed part way left a checkpoint, ask for just the rest of the file
+        whole.checkpoint = 1;
+        whole.codec = codec;
+        if ((resumeOffset = loadCheckpoint(argv[1], argv[2])) > 0)
+        {
+            printf("Resuming %s at byte %lld\n", argv[2], (long long)resumeOffset);
+            whole.ranged = 1;
+            whole.offset = resumeOffset;
+            whole.length = RANGE_TO_EOF;
+            whole.keepFile = 1;
+        }
+        status = (transferFile(argv, &whole, NULL) < 0) ? 1 : 0;
+    }
+    else
+    {
+        status = (transferStreams(argv, streams, codec) < 0) ? 1 : 0;
+    }
 
     // close(socketNum);
 
-    return 0;
+    return status;
 }
 
-void transferFile(char *argv[])
+// one stream of the file (or all of it, or a batch of files) through the FSM - returns 0 once
+// everything up to EOF is written, -1 if the file was bad or the server went away
+int transferFile(char *argv[], Range *range, Batch *batch)
 {
     Connection *server = (Connection *)calloc(1, sizeof(Connection));
     STATE state = START;
     int outFileFd = 0;
+    PacketBuffer *pb = NULL;
     uint32_t winSize = atoi(argv[3]);
     int32_t buffSize = atoi(argv[4]);
-    static uint32_t expectedSeqNum = START_SEQ_NUM;  // hold value outside of this function
+    uint32_t expectedSeqNum = START_SEQ_NUM;
+    uint32_t eofSeqNum = 0;  // 0 = no EOF seen yet
+    off_t checkpointAt = 0;  // getWriteOffset() the next checkpoint is saved at
+    int done = 0;
+    RttEstimator rtt;   // FNAME retransmission timer
+
+    initRtt(&rtt);
 
     while (state != DONE)
     {
         switch (state)
         {
             case START:
-                state = start_state(argv, server, &expectedSeqNum, winSize, buffSize);
+                state = start_state(argv, server, &expectedSeqNum, winSize, buffSize, range, batch);
                 break;
 
             case FNAME_RECV:
-                state = fnameRecv(argv[1], server);
+                state = fnameRecv(argv[1], server, &rtt, range);
                 break;
 
             case FILE_OK:
-                state = file_ok(&outFileFd, argv[2], winSize, buffSize);
+                state = file_ok(&outFileFd, argv[2], winSize, buffSize, &pb, range, batch);
+                if (range->checkpoint && !range->keepFile)
+                {
+                    clearCheckpoint(argv[2]); // the output was just truncated, an old checkpoint is wrong now
+                }
+                checkpointAt = range->offset + CHECKPOINT_LEN;
                 break;
 
             case RECV_DATA:
-                state = recvData(outFileFd, server, &expectedSeqNum);
+                state = recvData(pb, server, &expectedSeqNum, &eofSeqNum, batch);
+                if (range->checkpoint && state == RECV_DATA && getWriteOffset(pb) >= checkpointAt)
+                {
+                    saveCheckpoint(pb, argv[1], argv[2]);
+                    checkpointAt = getWriteOffset(pb) + CHECKPOINT_LEN;
+                }
                 break;
 
             default:
@@ -102,14 +225,567 @@ void transferFile(char *argv[])
     }
 
     // DONE State
+    done = (eofSeqNum != 0 && expectedSeqNum == eofSeqNum);
+    if (range->checkpoint && pb != NULL)
+    {
+        if (!done)
+        {
+            saveCheckpoint(pb, argv[1], argv[2]); // timed out - keep what made it to the file
+        }
+        else
+        {
+            // a resume overwrote the old tail in place, drop anything past the new end
+            if (range->keepFile && ftruncate(outFileFd, getWriteOffset(pb)) < 0)
+            {
+                perror("transferFile, ftruncate");
+            }
+            clearCheckpoint(argv[2]);
+        }
+    }
+    if (pb != NULL)
+    {
+        freePacketBuffer(pb);
+    }
     if (outFileFd > 0)
     {
         close(outFileFd);
     }
+    if (batch != NULL && batch->outFileFd >= 0)
+    {
+        close(batch->outFileFd);    // after the buffer, freeing it writes what's staged
+        batch->outFileFd = -1;
+    }
     free(server);
+
+    return (done && (batch == NULL || !batch->failed)) ? 0 : -1;
+}
+
+// copies every file the manifest (argv[1] after the '@') names, one source name per line, into
+// the argv[2] directory - as many names as fit in one FNAME_LIST share a session, window and
+// FNAME handshake, the files come back to back. Two entries with the same last path component
+// would write the same file, the later one is skipped - returns 0 or -1 if any of them failed
+int transferManifest(char *argv[], int codec)
+{
+    Batch *batch = (Batch *)calloc(1, sizeof(Batch));
+    Range whole = {0};
+    char line[PATH_MAX];
+    FILE *fp = NULL;
+    void *seen = NULL;  // tsearch() tree of the output names taken so far
+    char *name = NULL;
+    int failed = 0;
+
+    if (batch == NULL || (fp = fopen(&argv[1][1], "r")) == NULL)
+    {
+        perror("transferManifest, manifest");
+        free(batch);
+        return -1;
+    }
+    batch->outDir = argv[2];
+    batch->outFileFd = -1;
+    whole.codec = codec;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        int len = strcspn(line, "\n");
+        line[len] = '\0';
+        if (len == 0)
+        {
+            continue;
+        }
+        if (len >= MAX_FNAME_LEN)
+        {
+            fprintf(stderr, "Filename %s too long, must be less than %d characters\n", line, MAX_FNAME_LEN - 1);
+            failed = 1;
+            continue;
+        }
+        if (tfind(outputName(line), &seen, compareNames) != NULL)
+        {
+            fprintf(stderr, "File %s would overwrite an earlier entry's %s/%s, skipped\n", line, argv[2], outputName(line));
+            failed = 1;
+            continue;
+        }
+        if ((name = strdup(outputName(line))) == NULL || tsearch(name, &seen, compareNames) == NULL)
+        {
+            perror("transferManifest, names");
+            free(name);
+            failed = 1;
+            break;
+        }
+        // full - send this batch and start the next one with this name, room kept for ['\0'] [codec]
+        if (batch->count == MAX_BATCH || WIN_BUFF_LEN + batch->listLen + len + 1 + CODEC_LEN > MAX_PAYLOAD)
+        {
+            failed = (transferFile(argv, &whole, batch) < 0) || failed;
+            batch->count = 0;
+            batch->listLen = 0;
+            batch->failed = 0;
+        }
+        batch->names[batch->count++] = &batch->list[batch->listLen];
+        memcpy(&batch->list[batch->listLen], line, len + 1);
+        batch->listLen += len + 1;
+    }
+    if (batch->count > 0)
+    {
+        failed = (transferFile(argv, &whole, batch) < 0) || failed;
+    }
+
+    fclose(fp);
+    tdestroy(seen, free);
+    free(batch);
+    return failed ? -1 : 0;
+}
+
+// a manifest entry's output name, its last path component
+char *outputName(char *name)
+{
+    return (strrchr(name, '/') != NULL) ? strrchr(name, '/') + 1 : name;
+}
+
+// strcmp() for tsearch()
+int compareNames(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+// a NEXT_FILE came in order: the last entry is complete, its file is closed and the next entry's
+// output is opened - [index (4 bytes)] [1 = the server opened it, 0 = skipped] - returns 0 or -1
+int nextOutput(PacketBuffer *pb, Batch *batch, uint8_t *payload, int32_t len)
+{
+    char path[PATH_MAX];
+    uint32_t index = 0;
+    int fd = -1;
+
+    if (batch == NULL || len != NEXT_FILE_LEN)
+    {
+        fprintf(stderr, "Error: NEXT_FILE outside of a batch or %d bytes long.\n", len);
+        return -1;
+    }
+    memcpy(&index, payload, sizeof(index));
+    index = ntohl(index);
+    if (index >= (uint32_t)batch->count)
+    {
+        fprintf(stderr, "Error: NEXT_FILE for entry %u of a %d file batch.\n", index, batch->count);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", batch->outDir, outputName(batch->names[index]));
+    if (payload[sizeof(index)] == 0)
+    {
+        printf("File %s is not found\n", batch->names[index]);
+        batch->failed = 1;  // the rest of the batch still comes, the manifest just didn't all arrive
+    }
+    else if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+    {
+        perror("File open error: ");
+        return -1;
+    }
+
+    // the old file gets everything staged for it before it's closed
+    if (switchOutput(pb, fd) < 0)
+    {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (batch->outFileFd >= 0)
+    {
+        close(batch->outFileFd);
+    }
+    batch->outFileFd = fd;
+    return 0;
+}
+
+// byte offset a failed copy of srcName into outFileName got to, 0 = start over (no checkpoint,
+// it was for another source or the output is shorter than it says)
+off_t loadCheckpoint(char *srcName, char *outFileName)
+{
+    char path[PATH_MAX];
+    char savedName[PATH_MAX];
+    long long offset = 0;
+    struct stat st;
+    FILE *fp = NULL;
+
+    snprintf(path, sizeof(path), "%s%s", outFileName, RESUME_SUFFIX);
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        return 0;
+    }
+    if (fscanf(fp, "%lld ", &offset) != 1 || fgets(savedName, sizeof(savedName), fp) == NULL)
+    {
+        offset = 0;
+    }
+    fclose(fp);
+
+    savedName[strcspn(savedName, "\n")] = '\0';
+    if (offset <= 0 || strcmp(savedName, srcName) != 0 || stat(outFileName, &st) < 0 || st.st_size < offset)
+    {
+        return 0;
+    }
+    return (off_t)offset;
+}
+
+// writes the staged data out, then records how far the file is in outFileName.resume - written
+// to a temp file and renamed so a crash leaves the old checkpoint or the new one
+int saveCheckpoint(PacketBuffer *pb, char *srcName, char *outFileName)
+{
+    char path[PATH_MAX];
+    char tmpPath[PATH_MAX + sizeof(".tmp")];
+    FILE *fp = NULL;
+
+    if (flushStaged(pb) < 0)
+    {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s%s", outFileName, RESUME_SUFFIX);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    if ((fp = fopen(tmpPath, "w")) == NULL)
+    {
+        perror("saveCheckpoint, fopen");
+        return -1;
+    }
+    fprintf(fp, "%lld %s\n", (long long)getWriteOffset(pb), srcName);
+    if (fclose(fp) != 0 || rename(tmpPath, path) < 0)
+    {
+        perror("saveCheckpoint, write");
+        unlink(tmpPath);
+        return -1;
+    }
+    if (DEBUG_FLAG) printf("Checkpoint: %lld bytes of %s\n", (long long)getWriteOffset(pb), outFileName);
+    return 0;
+}
+
+void clearCheckpoint(char *outFileName)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s%s", outFileName, RESUME_SUFFIX);
+    unlink(path);
 }
 
-STATE start_state(char **argv, Connection *server, uint32_t *expectedSeqNum, uint32_t winSize, int32_t buffSize)
+// splits the file into streams byte ranges and transfers them at once, each from its own forked
+// rcopy with its own socket, window and server session, written in place with pwrite(). A zero
+// length range goes first to create the output file and learn the size from FNAME_OK - returns
+// 0 once every range is in, -1 otherwise
+int transferStreams(char *argv[], int streams, int codec)
+{
+    Range probe = {1, 0, 0, 0, 0, 0, codec};
+    int outFileFd = 0;
+    int running = 0;
+    int failed = 0;
+    int status = 0;
+
+    if (transferFile(argv, &probe, NULL) < 0)
+    {
+        return -1;
+    }
+    if (probe.fileSize == 0)
+    {
+        // empty, not a regular file or FNAME_OK was lost - nothing to split, send it whole
+        Range whole = {0};
+        whole.codec = codec;
+        return transferFile(argv, &whole, NULL);
+    }
+
+    // full length up front, every stream writes into its own part
+    if ((outFileFd = open(argv[2], O_WRONLY)) < 0 || ftruncate(outFileFd, probe.fileSize) < 0)
+    {
+        perror("transferStreams, output file");
+        if (outFileFd >= 0) close(outFileFd);
+        return -1;
+    }
+    close(outFileFd);
+
+    uint64_t chunk = (probe.fileSize + streams - 1) / streams;
+    for (int i = 0; i < streams && (uint64_t)i * chunk < probe.fileSize; i++)
+    {
+        Range range = {1, (uint64_t)i * chunk, chunk, 1, 0, 0, codec};
+        if (range.offset + range.length > probe.fileSize)
+        {
+            range.length = probe.fileSize - range.offset;
+        }
+
+        fflush(NULL); // or the children print whatever the parent had buffered again
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("transferStreams, fork");
+            failed = 1;
+            break;
+        }
+        if (pid == 0)
+        {
+            exit((transferFile(argv, &range, NULL) < 0) ? 1 : 0);
+        }
+        running++;
+    }
+
+    while (running > 0)
+    {
+        if (wait(&status) < 0)
+        {
+            perror("transferStreams, wait");
+            return -1;
+        }
+        failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        running--;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "Error: a stream of %s did not finish.\n", argv[1]);
+        return -1;
+    }
+    return 0;
+}
+
+// rsync-like update of an old argv[2] the other way round: the server sends its file's chunk
+// signatures (FNAME_SIGS), rcopy chunks its old copy the same way and asks only for the chunks it
+// doesn't have, as ranges in as few FNAMEs as they fit in. The new file is put together in
+// <dst>.tmp from the old copy and those bytes, every chunk checked against its signature,
+// then renamed over argv[2] so a failure leaves the old copy as it was - returns 0 or -1
+int transferDelta(char *argv[], int codec)
+{
+    char sigPath[PATH_MAX + sizeof(SIGS_SUFFIX)];
+    char spillPath[PATH_MAX + sizeof(SPILL_SUFFIX)];
+    char tmpPath[PATH_MAX + sizeof(".tmp")];
+    char *sigArgv[8];
+    Range sigRange = {0};
+    Delta delta = {0};
+    int outFd = -1;
+    int status = -1;
+    struct stat st;
+
+    snprintf(sigPath, sizeof(sigPath), "%s%s", argv[2], SIGS_SUFFIX);
+    snprintf(spillPath, sizeof(spillPath), "%s%s", argv[2], SPILL_SUFFIX);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", argv[2]);
+    memcpy(sigArgv, argv, sizeof(sigArgv));
+    sigArgv[2] = sigPath;
+    sigRange.sigs = 1;
+
+    if (transferFile(sigArgv, &sigRange, NULL) < 0 || mapFile(sigPath, &delta.sigs, &delta.sigsLen) < 0 ||
+        mapFile(argv[2], &delta.old, &delta.oldLen) < 0 || delta.sigsLen % SIG_LEN != 0)
+    {
+        fprintf(stderr, "Error: no chunk signatures for %s.\n", argv[1]);
+    }
+    else if (planDelta(&delta, argv[2]) < 0)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for the delta.\n");
+    }
+    else if (delta.spanCount > 0 &&
+             (fetchSpans(argv, spillPath, delta.spans, delta.spanCount, codec) < 0 || mapFile(spillPath, &delta.spill, &delta.spillLen) < 0))
+    {
+        fprintf(stderr, "Error: the changed ranges of %s did not arrive.\n", argv[1]);
+    }
+    else if ((outFd = open(tmpPath, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+    {
+        perror("transferDelta, open");
+    }
+    else
+    {
+        if (stat(argv[2], &st) == 0 && fchmod(outFd, st.st_mode & 07777) < 0)
+        {
+            perror("transferDelta, fchmod"); // keeping the old copy's permissions is only a nicety
+        }
+        status = buildDelta(outFd, &delta);
+        if (close(outFd) < 0 || (status == 0 && rename(tmpPath, argv[2]) < 0))
+        {
+            perror("transferDelta, new copy");
+            status = -1;
+        }
+        if (status < 0)
+        {
+            unlink(tmpPath);
+        }
+        else
+        {
+            clearCheckpoint(argv[2]); // argv[2] is whole now, a resume from an older failure doesn't apply
+        }
+    }
+
+    freeDelta(&delta);
+    unlink(sigPath);
+    unlink(spillPath);
+    return status;
+}
+
+// finds each of the server's chunks in the old copy or adds it to the ranges to fetch, chunks
+// next to each other in the source are one range - returns 0 or -1 on error
+int planDelta(Delta *delta, char *outFileName)
+{
+    off_t count = delta->sigsLen / SIG_LEN;
+    off_t newLen = 0;
+    off_t reused = 0;
+    DeltaIndex *index = initDeltaIndex(delta->old, delta->oldLen);
+
+    delta->matches = (off_t *)malloc((count + 1) * sizeof(off_t));
+    delta->spans = (uint64_t *)malloc((count + 1) * 2 * sizeof(uint64_t));
+    if (index == NULL || delta->matches == NULL || delta->spans == NULL)
+    {
+        freeDeltaIndex(index);
+        return -1;
+    }
+
+    for (off_t i = 0; i < count; i++)
+    {
+        const uint8_t *sig = &delta->sigs[i * SIG_LEN];
+        uint64_t *last = &delta->spans[2 * delta->spanCount]; // one past the last range so far
+        if ((delta->matches[i] = findChunk(index, sig)) >= 0)
+        {
+            reused += sigLength(sig);
+        }
+        else if (delta->spanCount > 0 && last[-2] + last[-1] == (uint64_t)newLen)
+        {
+            last[-1] += sigLength(sig);
+        }
+        else
+        {
+            delta->spans[2 * delta->spanCount] = newLen;
+            delta->spans[2 * delta->spanCount + 1] = sigLength(sig);
+            delta->spanCount++;
+        }
+        newLen += sigLength(sig);
+    }
+    freeDeltaIndex(index);
+
+    printf("Delta: %lld of %lld bytes already in %s, fetching %lld in %d range(s)\n",
+           (long long)reused, (long long)newLen, outFileName, (long long)(newLen - reused), delta->spanCount);
+    return 0;
+}
+
+void freeDelta(Delta *delta)
+{
+    if (delta->old != NULL) munmap(delta->old, delta->oldLen);
+    if (delta->sigs != NULL) munmap(delta->sigs, delta->sigsLen);
+    if (delta->spill != NULL) munmap(delta->spill, delta->spillLen);
+    free(delta->matches);
+    free(delta->spans);
+}
+
+// the changed ranges, as many per session as one FNAME carries, into spillPath one after
+// another - returns 0 or -1 if a session failed
+int fetchSpans(char *argv[], char *spillPath, uint64_t *spans, int spanCount, int codec)
+{
+    char *spillArgv[8];
+    int perFname = (MAX_PAYLOAD - WIN_BUFF_LEN - (int)strlen(argv[1]) - 1 - CODEC_LEN) / RANGE_LEN;
+    uint64_t spillOffset = 0;
+
+    memcpy(spillArgv, argv, sizeof(spillArgv));
+    spillArgv[2] = spillPath;
+    for (int i = 0; i < spanCount; i += perFname)
+    {
+        Range part = {1, spillOffset, 0, (i > 0), 0, 0, codec};
+        part.spans = &spans[2 * i];
+        part.spanCount = (spanCount - i < perFname) ? spanCount - i : perFname;
+        if (transferFile(spillArgv, &part, NULL) < 0)
+        {
+            return -1;
+        }
+        for (int j = 0; j < part.spanCount; j++)
+        {
+            spillOffset += part.spans[2 * j + 1];
+        }
+    }
+    return 0;
+}
+
+// writes the server's chunks in order, each out of the old copy or the next bytes of the spill.
+// Every chunk has to match its SHA-256 signature again as it's written, so nothing reaches the
+// rename unchecked. A fetched one doesn't if the source changed between the signatures and the
+// ranges, an old one if the old copy changed under its mapping - runs that are contiguous in old
+// or spill go out in one write()
+int buildDelta(int outFd, Delta *delta)
+{
+    uint8_t sig[SIG_LEN];
+    const uint8_t *run = NULL;
+    off_t runLen = 0;
+    off_t spillPos = 0;
+
+    for (off_t i = 0; i < delta->sigsLen / SIG_LEN; i++)
+    {
+        uint32_t len = sigLength(&delta->sigs[i * SIG_LEN]);
+        const uint8_t *chunk = NULL;
+
+        if (delta->matches[i] >= 0)
+        {
+            chunk = &delta->old[delta->matches[i]];
+        }
+        else
+        {
+            if (delta->spillLen - spillPos < len)
+            {
+                fprintf(stderr, "Error: delta ranges came back short, %lld bytes.\n", (long long)delta->spillLen);
+                return -1;
+            }
+            chunk = &delta->spill[spillPos];
+            spillPos += len;
+        }
+        signChunk(chunk, len, sig);
+        if (memcmp(sig, &delta->sigs[i * SIG_LEN], SIG_LEN) != 0)
+        {
+            fprintf(stderr, "Error: chunk %lld doesn't match its signature, the %s changed.\n", (long long)i,
+                    (delta->matches[i] >= 0) ? "old copy" : "source");
+            return -1;
+        }
+
+        if (run != NULL && run + runLen == chunk)
+        {
+            runLen += len;
+            continue;
+        }
+        if (runLen > 0 && writeOut(outFd, run, runLen) < 0)
+        {
+            return -1;
+        }
+        run = chunk;
+        runLen = len;
+    }
+    return (runLen > 0) ? writeOut(outFd, run, runLen) : 0;
+}
+
+// maps all of path read-only, an empty file is NULL with *len 0 - returns 0 or -1 on error
+int mapFile(char *path, uint8_t **data, off_t *len)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    *data = NULL;
+    *len = 0;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror("mapFile, open");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            perror("mapFile, mmap");
+            close(fd);
+            return -1;
+        }
+        *data = (uint8_t *)map;
+        *len = st.st_size;
+    }
+    close(fd);
+    return 0;
+}
+
+int writeOut(int fd, const uint8_t *data, off_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = write(fd, data, (len < (1 << 30)) ? len : (1 << 30));
+        if (ret < 0)
+        {
+            perror("writeOut, write");
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+STATE start_state(char **argv, Connection *server, uint32_t *expectedSeqNum, uint32_t winSize, int32_t buffSize, Range *range, Batch *batch)
 {
     uint8_t packet[MAX_PACK_LEN] = {0};
     uint8_t buffer[MAX_PACK_LEN] = {0};
@@ -153,13 +829,48 @@ STATE start_state(char **argv, Connection *server, uint32_t *expectedSeqNum, uin
 
         // send packet to server with filename
         len = WIN_BUFF_LEN + fileNameLen;
-        sendBuff(buffer, len, server, FNAME, 0, packet);
+        if (range->ranged || range->codec != CODEC_NONE)
+        {
+            // [fileName] ['\0'] [offset (8 bytes)] [length (8 bytes)] asks for just this stream's bytes,
+            // the whole file is (0, RANGE_TO_EOF) when only a codec needs the tail and a delta
+            // sends one of them per changed range
+            uint64_t single[2] = {range->ranged ? range->offset : 0, range->ranged ? range->length : RANGE_TO_EOF};
+            uint64_t *spans = (range->spanCount > 0) ? range->spans : single;
+            buffer[len++] = '\0';
+            for (int i = 0; i < ((range->spanCount > 0) ? range->spanCount : 1); i++)
+            {
+                uint64_t offsetNet = htobe64(spans[2 * i]);
+                uint64_t lengthNet = htobe64(spans[2 * i + 1]);
+                memcpy(&buffer[len], &offsetNet, sizeof(offsetNet));
+                memcpy(&buffer[len + sizeof(offsetNet)], &lengthNet, sizeof(lengthNet));
+                len += RANGE_LEN;
+            }
+            if (range->codec != CODEC_NONE)
+            {
+                buffer[len++] = (uint8_t)range->codec; // [codec (1 byte)]
+            }
+        }
+        if (batch != NULL)
+        {
+            // [fileName '\n' fileName ...] in place of the one name
+            for (int i = 0; i < batch->listLen - 1; i++)
+            {
+                buffer[WIN_BUFF_LEN + i] = (batch->list[i] == '\0') ? '\n' : batch->list[i];
+            }
+            len = WIN_BUFF_LEN + batch->listLen - 1;
+            if (range->codec != CODEC_NONE)
+            {
+                buffer[len++] = '\0';
+                buffer[len++] = (uint8_t)range->codec;
+            }
+        }
+        sendBuff(buffer, len, server, (batch != NULL) ? FNAME_LIST : (range->sigs ? FNAME_SIGS : FNAME), 0, packet);
     }
 
     return retVal;
 }
 
-STATE fnameRecv(char *fname, Connection *server)
+STATE fnameRecv(char *fname, Connection *server, RttEstimator *rtt, Range *range)
 {
     // get server response
     // returns START if no reply, DONE if bad filename, FILE_OK otherwise
@@ -168,9 +879,8 @@ STATE fnameRecv(char *fname, Connection *server)
     uint8_t flag = 0;
     uint32_t seqNum = 0;
     int32_t recvCheck = 0;
-    static int retryCnt = 0;
 
-    if ((retVal = processSelect(server, &retryCnt, START, FILE_OK, DONE)) == FILE_OK)
+    if ((retVal = processSelect(server, rtt, START, FILE_OK, DONE)) == FILE_OK)
     {
         recvCheck = recvBuff(packet, MAX_PACK_LEN, server->socketNum, server, &flag, &seqNum);
 
@@ -184,39 +894,65 @@ STATE fnameRecv(char *fname, Connection *server)
             printf("File %s is not found\n", fname);
             retVal = DONE;
         }
-        else if (flag == DATA)
+        else if (flag == DATA || flag == NEXT_FILE)
         {
             // file yes/no packet lost - instead its a data packet
             retVal = FILE_OK;
         }
+        else if (flag == FNAME_OK && recvCheck >= FILE_SIZE_LEN)
+        {
+            uint64_t fileSize = 0;
+            memcpy(&fileSize, packet, FILE_SIZE_LEN);
+            range->fileSize = be64toh(fileSize);
+        }
     }
     return retVal;
 }
 
-STATE file_ok(int *outFileFd, char *outFileName, uint32_t winSize, int32_t buffSize)
+STATE file_ok(int *outFileFd, char *outFileName, uint32_t winSize, int32_t buffSize, PacketBuffer **pb, Range *range, Batch *batch)
 {
     STATE retVal = DONE;
 
-    if ((*outFileFd = open(outFileName, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+    // a stream writes its range in place, the file was created and sized before the streams started
+    // a batch opens each output as its NEXT_FILE comes in
+    if (batch == NULL && (*outFileFd = open(outFileName, O_CREAT | O_WRONLY | (range->keepFile ? 0 : O_TRUNC), 0600)) < 0)
     {
         perror("File open error: ");
         retVal = DONE;
     }
+    else if ((*pb = initPacketBuffer(winSize, buffSize, (batch == NULL) ? *outFileFd : -1)) == NULL)
+    {
+        retVal = DONE;
+    }
+    else if (range->ranged && setWriteOffset(*pb, range->offset) < 0)
+    {
+        retVal = DONE;
+    }
+    else if (setCodec(*pb, range->codec) < 0)
+    {
+        retVal = DONE;
+    }
     else
     { // file opened and ready to receive data
-        initPacketBuffer(winSize, buffSize, *outFileFd);
         retVal = RECV_DATA;
     }
     return retVal;
 }
 
-STATE recvData(int32_t outFile, Connection *server, uint32_t *expectedSeqNum)
+STATE recvData(PacketBuffer *pb, Connection *server, uint32_t *expectedSeqNum, uint32_t *eofSeqNum, Batch *batch)
 {
-    uint8_t dataBuff[MAX_PACK_LEN];
+    uint8_t heads[RECV_BATCH][sizeof(Header)];
+    uint8_t **slots = getRecvSlots(pb);
+    int32_t dataLens[RECV_BATCH];
+    uint8_t flags[RECV_BATCH];
+    uint32_t seqNums[RECV_BATCH];
     uint8_t packet[MAX_PACK_LEN];
-    uint8_t flag = 0;
+    uint8_t sack[sizeof(uint32_t) + SACK_MAP_LEN];
     uint32_t ackSeqNum = 0;
-    int32_t dataLen = 0;
+    int mapLen = 0;
+    int sendRR = 0;
+    int sendSrej = 0;
+    int numRecv = 0;
 
     if (selectCall(server->socketNum, LONG_TIME, 0) == 0)
     {
@@ -224,89 +960,127 @@ STATE recvData(int32_t outFile, Connection *server, uint32_t *expectedSeqNum)
         return DONE;
     }
 
-    dataLen = recvBuff(dataBuff, MAX_PACK_LEN, server->socketNum, server, &flag, &ackSeqNum);
+    // drain everything already queued, the whole batch gets answered with one RR or SACK
+    // the data goes straight into free PacketBuffer slots, headers into heads
+    numRecv = recvBuffs(heads, slots, getSlotLen(pb), dataLens, flags, seqNums, RECV_BATCH, server->socketNum, server);
 
-    // do state RECV_DATA again if there is a  crc error (don't send ack, don't write data)
-    if (dataLen == CRC_ERROR)
-    {
-        return RECV_DATA;
-    }
-    if (flag == END_OF_FILE)
-    {
-        // send ACK_RR
-        sendBuff(packet, 1, server, EOF_ACK, *expectedSeqNum, packet);
-        freePacketBuffer();
-        if (DEBUG_FLAG) printf("File done\n");
-        return DONE;
-    }
-    else if (flag == DATA || flag == SREJ_DATA || flag == TIMEOUT_DATA)
+    for (int i = 0; i < numRecv; i++)
     {
-        // recv out of order packet
-        if (ackSeqNum > *expectedSeqNum)
+        uint8_t *dataBuff = slots[i];
+
+        // skip packets with a crc error (don't ack, don't write data)
+        if (dataLens[i] == CRC_ERROR)
+        {
+            continue;
+        }
+        if (flags[i] == END_OF_FILE)
+        {
+            // only done once everything before EOF is written, checked after the batch
+            // it's remembered across batches in case EOF beat a resent packet here
+            *eofSeqNum = seqNums[i];
+            sendSrej = sendSrej || (seqNums[i] > *expectedSeqNum);
+        }
+        else if (flags[i] == DATA || flags[i] == SREJ_DATA || flags[i] == TIMEOUT_DATA)
         {
-            // out of order packet -> buffer and send SREJ
-            if (bufferOpen())   // shoulkd always be open here but just in case rcopy can't buffer
+            // recv out of order packet
+            if (seqNums[i] > *expectedSeqNum)
+            {
+                // out of order packet -> keep its slot in the buffer (no copy) and SACK the holes
+                if (bufferOpen(pb))   // shoulkd always be open here but just in case rcopy can't buffer
+                {
+                    if (addRecvSlot(pb, i, dataLens[i], seqNums[i]) < 0)
+                    {
+                        fprintf(stderr, "Error: Failed to add packet to buffer.\n");
+                        return DONE;
+                    }
+                }
+                sendSrej = 1;
+            }
+            // recv expected packet
+            else if (seqNums[i] == *expectedSeqNum)
             {
-                if (addPacket(dataBuff, dataLen, ackSeqNum) < 0)
+                // write data to file and flush any buffered packets now in order behind it
+                if (writePacket(pb, dataBuff, dataLens[i]) < 0)
                 {
-                    fprintf(stderr, "Error: Failed to add packet to buffer.\n");
+                    perror("Error writing to output file in recvData where rcopy got expected seq num");
                     return DONE;
                 }
+                (*expectedSeqNum) = getNextSeqNum(pb); // update expected sequence number to the one after the latest one written from buff
             }
-
-            // send SREJ
-            ackSeqNum = htonl(*expectedSeqNum); // this is unnecessary because the buffer/packet won't even be read by the server in this case
-            sendBuff((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, SREJ, *expectedSeqNum, packet);
-            return RECV_DATA;
+            // either alr written or just received this packet -> ACK_RR
+            // duplicates get one too in case the ACK_RR that covered them was lost
+            sendRR = sendRR || (seqNums[i] <= *expectedSeqNum);
         }
-        // recv expected packet
-        else if (ackSeqNum == *expectedSeqNum)
+        else if (flags[i] == NEXT_FILE)
         {
-            if (needFlush())
+            // a batch's file boundary is only taken in order - an early one isn't buffered, the
+            // SACK reports it as a hole and it comes again once everything before it is in
+            if (seqNums[i] == *expectedSeqNum)
             {
-                flushBuffer(); // write packets to file clear buffer
-                (*expectedSeqNum) = getNextSeqNum(); // update expected sequence number to the one after thelatest one written from buff
-            }
-            else
-            {
-                // write data to file
-                if (write(outFile, dataBuff, dataLen) < 0)
+                if (nextOutput(pb, batch, dataBuff, dataLens[i]) < 0)
                 {
-                    perror("Error writing to output file in recvData where rcopy got expected seq num");
                     return DONE;
                 }
-
-                // //~!*
-                // if (fsync(outFile) < 0)
-                // {
-                //     fprintf(stderr, "Error syncing output file after writing packet in expected seq %u\n", *expectedSeqNum);
-                //     return -1;
-                // }
-
-                (*expectedSeqNum)++;
+                (*expectedSeqNum) = getNextSeqNum(pb);
             }
-            // either alr written or just received this packet -> send ACK_RR
-            ackSeqNum = htonl(*expectedSeqNum - 1); // send ack for the last expected seq num that should be alr written
-            sendBuff((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, ACK_RR, ((*expectedSeqNum) - 1), packet);
-            return RECV_DATA;
+            sendSrej = sendSrej || (seqNums[i] > *expectedSeqNum);
+            sendRR = sendRR || (seqNums[i] <= *expectedSeqNum);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR - recvData: received unexpected flag %d\n", flags[i]);
+            return DONE;
         }
     }
-    else
+
+    if (*eofSeqNum != 0 && *eofSeqNum == *expectedSeqNum)
     {
-        fprintf(stderr, "ERROR - recvData: received unexpected flag %d\n", flag);
+        // everything before EOF is written once the write-behind buffer is out - send ACK_RR
+        if (flushStaged(pb) < 0)
+        {
+            return DONE;
+        }
+        sendBuff(packet, 1, server, EOF_ACK, *expectedSeqNum, packet);
+        if (DEBUG_FLAG) printf("File done\n");
         return DONE;
     }
-    return RECV_DATA; // default case, just to make the warning go away
+    if ((sendSrej || sendRR) && (needFlush(pb) || *eofSeqNum > *expectedSeqNum))
+    {
+        // packets (or EOF) got ahead of a hole that is still open after the batch - report every
+        // hole at once: [base = expectedSeqNum] [bit i set = base + i is buffered], base - 1 is the cumulative ack
+        ackSeqNum = htonl(*expectedSeqNum);
+        memcpy(sack, &ackSeqNum, sizeof(ackSeqNum));
+        if ((mapLen = getSackMap(pb, &sack[sizeof(ackSeqNum)], SACK_MAP_LEN)) < 0)
+        {
+            return DONE;
+        }
+        // EOF went out after every data packet, so set its bit too - all holes before it are lost, not late
+        if (*eofSeqNum > *expectedSeqNum && *eofSeqNum - *expectedSeqNum < SACK_MAP_LEN * 8)
+        {
+            uint32_t bit = *eofSeqNum - *expectedSeqNum;
+            sack[sizeof(ackSeqNum) + bit / 8] |= (1 << (bit % 8));
+            mapLen = (mapLen > (int)(bit / 8 + 1)) ? mapLen : (int)(bit / 8 + 1);
+        }
+        sendBuff(sack, sizeof(ackSeqNum) + mapLen, server, SACK, *expectedSeqNum, packet);
+    }
+    else if (sendRR)
+    {
+        // one cumulative ack for the last seq num that should be alr written
+        ackSeqNum = htonl(*expectedSeqNum - 1);
+        sendBuff((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, ACK_RR, ((*expectedSeqNum) - 1), packet);
+    }
+    return RECV_DATA;
 }
 
-void checkArgs(int argc, char *argv[], float *errorRate)
+void checkArgs(int argc, char *argv[], float *errorRate, int *streams, int *codec, int *delta)
 {
     *errorRate = 0;
 
     /* check command line arguments  */
-    if (argc != 8)
+    if (argc < 8 || argc > 11)
     {
-        printf("usage: %s <filepath src> <filepath dest> <window size> <buffer size> <error rate> <host name> <port number> \n", argv[0]);
+        printf("usage: %s <filepath src> <filepath dest> <window size> <buffer size> <error rate> <host name> <port number> [optional streams] [optional compression none|lz4] [optional sync full|delta] \n", argv[0]);
+        printf("       %s @<manifest> <dest directory> ... copies every file the manifest lists, one per line\n", argv[0]);
         exit(1);
     }
     if (strlen(argv[1]) > 1000)
@@ -335,5 +1109,34 @@ void checkArgs(int argc, char *argv[], float *errorRate)
         exit(-1);
     }
 
+    if (argc >= 9 && argv[1][0] == '@' && atoi(argv[8]) != 1)
+    {
+        fprintf(stderr, "Streams can't be used with a manifest\n");
+        exit(-1);
+    }
+    if (argc >= 9 && (atoi(argv[8]) < 1 || atoi(argv[8]) > MAX_STREAMS))
+    {
+        fprintf(stderr, "Streams must be between 1 and %d inclusive and is %d\n", MAX_STREAMS, atoi(argv[8]));
+        exit(-1);
+    }
+    if (argc == 11 && strcmp(argv[10], "full") != 0 && strcmp(argv[10], "delta") != 0)
+    {
+        fprintf(stderr, "Sync must be full or delta and is %s\n", argv[10]);
+        exit(-1);
+    }
+    if (argc == 11 && strcmp(argv[10], "delta") == 0 && (argv[1][0] == '@' || atoi(argv[8]) != 1))
+    {
+        fprintf(stderr, "A delta sync can't be used with a manifest or streams\n");
+        exit(-1);
+    }
+    if (argc >= 10 && findCodec(argv[9]) < 0)
+    {
+        fprintf(stderr, "Compression must be none or lz4 and is %s\n", argv[9]);
+        exit(-1);
+    }
+
     *errorRate = atof(argv[5]);
+    *streams = (argc >= 9) ? atoi(argv[8]) : 1;
+    *codec = (argc >= 10) ? findCodec(argv[9]) : CODEC_NONE;
+    *delta = (argc == 11 && strcmp(argv[10], "delta") == 0);
 }
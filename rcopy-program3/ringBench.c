@@ -0,0 +1,104 @@
+// Microbenchmark of the window and packet buffer rings, per packet cost of the bookkeeping
+// around a transfer without the network or the disk - build with make ringBench
+// usage: ringBench [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "window.h"
+#include "buffer.h"
+
+#define BENCH_BUFF_SIZE 1400
+#define DEFAULT_ROUNDS 20000
+
+static const uint32_t winSizes[] = {5, 64, 100, 229};
+
+static double nowSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// server side: fill the window in place, ACK it and slide, one pane at a time like a steady
+// stream of ACK_RRs - returns ns per pane
+static double benchWindow(uint32_t winSize, int rounds)
+{
+    Window *win = initWindow(winSize, BENCH_BUFF_SIZE);
+    uint32_t seqNum = START_SEQ_NUM;
+    double start = 0;
+
+    if (win == NULL)
+    {
+        return -1;
+    }
+    while (windowOpen(win))
+    {
+        addPane(win, BENCH_BUFF_SIZE, seqNum++);
+    }
+
+    start = nowSec();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (uint32_t i = 0; i < winSize; i++)
+        {
+            markPaneAck(win, getLowerBound(win));
+            slideWindow(win, getLowerBound(win) + 1);
+            getPaneBuff(win)[0] = (uint8_t)seqNum;
+            addPane(win, BENCH_BUFF_SIZE, seqNum++);
+        }
+    }
+    double ns = (nowSec() - start) * 1e9 / ((double)rounds * winSize);
+
+    freeWindow(win);
+    return ns;
+}
+
+// rcopy side: everything but the next in-order packet arrives first, then the in-order one
+// flushes the lot through the write-behind stage into /dev/null - returns ns per packet
+static double benchBuffer(uint32_t winSize, int rounds, uint8_t *data)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    PacketBuffer *pb = initPacketBuffer(winSize, BENCH_BUFF_SIZE, fd);
+    double start = 0;
+
+    if (pb == NULL)
+    {
+        return -1;
+    }
+
+    start = nowSec();
+    for (int r = 0; r < rounds; r++)
+    {
+        uint32_t next = getNextSeqNum(pb);
+        for (uint32_t i = 1; i < winSize; i++)
+        {
+            addPacket(pb, data, BENCH_BUFF_SIZE, next + i);
+        }
+        writePacket(pb, data, BENCH_BUFF_SIZE);
+    }
+    double ns = (nowSec() - start) * 1e9 / ((double)rounds * winSize);
+
+    freePacketBuffer(pb);
+    close(fd);
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    uint8_t data[BENCH_BUFF_SIZE];
+
+    memset(data, 'A', BENCH_BUFF_SIZE);
+    printf("%-8s %14s %14s\n", "winSize", "window ns/pkt", "buffer ns/pkt");
+    for (size_t i = 0; i < sizeof(winSizes) / sizeof(winSizes[0]); i++)
+    {
+        int r = (int)(rounds * (double)winSizes[0] / winSizes[i]) + 1; // about the same packets each size
+        printf("%-8u %14.1f %14.1f\n", winSizes[i], benchWindow(winSizes[i], r * 20), benchBuffer(winSizes[i], r * 20, data));
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Round trip time estimator for rcopy Project 3 Networks 464 class
+
+#include "srej.h"
+
+// func defs start
+
+// no samples yet so start at the old fixed SHORT_TIME timeout
+void initRtt(RttEstimator *rtt)
+{
+    rtt->srtt = 0;
+    rtt->rttvar = 0;
+    rtt->rto = RTO_INIT_US;
+    rtt->backoff = 0;
+    rtt->lastHeard = getTimeUs();
+}
+
+// RFC 6298: the first sample sets SRTT = R and RTTVAR = R/2, after that
+// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R| and SRTT = 7/8 SRTT + 1/8 R, RTO = SRTT + 4 RTTVAR
+void updateRtt(RttEstimator *rtt, uint64_t sample)
+{
+    if (sample == 0)
+    {
+        sample = 1; // sub-microsecond round trip, still counts as a sample
+    }
+
+    if (rtt->srtt == 0)
+    {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+    }
+    else
+    {
+        uint64_t delta = (rtt->srtt > sample) ? rtt->srtt - sample : sample - rtt->srtt;
+        rtt->rttvar = (3 * rtt->rttvar + delta) / 4;
+        rtt->srtt = (7 * rtt->srtt + sample) / 8;
+    }
+
+    rtt->rto = rtt->srtt + 4 * rtt->rttvar;
+    if (rtt->rto < RTO_MIN_US) rtt->rto = RTO_MIN_US;
+    if (rtt->rto > RTO_MAX_US) rtt->rto = RTO_MAX_US;
+}
+
+// returns the timeout to wait right now in microseconds, never more than RTO_MAX_US
+uint64_t getRto(RttEstimator *rtt)
+{
+    uint64_t rto = rtt->rto << rtt->backoff;
+    return (rto > RTO_MAX_US) ? RTO_MAX_US : rto;
+}
+
+// a timeout fired, double the wait for the next one - returns 0 or -1 once the other side
+// has been quiet for GIVE_UP_US (LONG_TIME seconds) and should be given up on
+int backoffRtt(RttEstimator *rtt)
+{
+    if (getTimeUs() - rtt->lastHeard >= GIVE_UP_US)
+    {
+        return -1;
+    }
+    if ((rtt->rto << rtt->backoff) < RTO_MAX_US)
+    {
+        rtt->backoff++;
+    }
+    return 0;
+}
+
+// the other side answered
+void resetBackoff(RttEstimator *rtt)
+{
+    rtt->backoff = 0;
+    rtt->lastHeard = getTimeUs();
+}
+
+// monotonic clock in microseconds for timers and RTT samples
+uint64_t getTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// func defs end
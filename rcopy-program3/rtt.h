@@ -0,0 +1,34 @@
+// written by Lukas Shipley
+
+#ifndef __RTT_H__
+#define __RTT_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// SHORT_TIME and LONG_TIME come from srej.h, which includes this header
+#define RTO_INIT_US ((uint64_t)SHORT_TIME * 1000000)   // timeout before the first RTT sample
+#define RTO_MIN_US 1000                                 // 1 ms floor so a loopback RTT doesn't fire on scheduling jitter
+#define RTO_MAX_US ((uint64_t)SHORT_TIME * 1000000)    // longest single wait, keeps retrying well inside rcopy's LONG_TIME
+#define GIVE_UP_US ((uint64_t)LONG_TIME * 1000000)     // silent this long means the other side is gone
+
+typedef struct
+{
+    uint64_t srtt;      // smoothed RTT in us, 0 = no sample yet
+    uint64_t rttvar;    // RTT variation in us
+    uint64_t rto;       // retransmission timeout in us before backoff
+    int backoff;        // timeouts in a row, each one doubles the RTO
+    uint64_t lastHeard; // monotonic us the other side was last heard from
+} RttEstimator; // Jacobson/Karels estimator (RFC 6298), one per connection
+
+void initRtt(RttEstimator *rtt);
+void updateRtt(RttEstimator *rtt, uint64_t sample);  // feed one RTT sample in us
+uint64_t getRto(RttEstimator *rtt);                 // current timeout in us, backoff included
+int backoffRtt(RttEstimator *rtt);                  // double the timeout, -1 = silent for GIVE_UP_US give up
+void resetBackoff(RttEstimator *rtt);               // the other side answered
+
+uint64_t getTimeUs(); // monotonic clock in microseconds
+
+#endif
@@ -10,9 +10,11 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <signal.h>
-#include <sys/wait.h>
-#include <bits/waitflags.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <endian.h>
 
 #include "gethostbyname.h"
 #include "networks.h"
@@ -21,11 +23,18 @@
 #include "cpe464.h"
 #include "srej.h"
 #include "window.h"
+#include "congestion.h"
+#include "pacer.h"
+#include "filesource.h"
 
 #define MAX_PACK_LEN 1500
 #define MAX_PAYLOAD 1400
+#define MAX_EVENTS 64
+#define MAX_SPANS (MAX_PACK_LEN / RANGE_LEN)	// most byte ranges one FNAME can carry
 
 typedef enum State STATE;
+typedef struct session Session;
+typedef struct retired Retired;
 
 enum State
 {
@@ -39,168 +48,342 @@ enum State
 	DONE
 };
 
+// one in-flight transfer - everything a forked child used to keep on its stack
+struct session
+{
+	Connection client;	// rcopy's address and this session's own socket
+	Window *win;		// private sliding window
+	STATE state;
+	int32_t dataFile;
+	FileSource *source;	// dataFile mapped (or read in large chunks), panes point into it
+	int32_t buffSize;
+	uint32_t nextToSend;	// FSM global next seqNum to send
+	int eofSent;
+	RttEstimator rtt;	// SRTT/RTTVAR for this client and the timeout backoff
+	uint64_t deadline;	// monotonic us when the EOF wait times out, panes have their own timers in the window
+	Congestion cc;		// caps the window below rcopy's winSize from loss and RTT feedback
+	Pacer pacer;		// spaces new data out instead of sending the open window back to back
+	int64_t paceRate;	// PACE_OFF, PACE_AUTO or a fixed rate in packets/s
+	char *batch;		// FNAME_LIST names, '\n' separated, NULL = one file
+	char *nextName;		// next batch entry to open, NULL = none left
+	uint32_t fileIndex;	// batch entries started so far
+	Retired *retired;	// finished batch files, their panes may still be unACKed
+	int codec;		// CODEC_NONE, or every data pane is one chunk packed with it
+	int sigs;		// FNAME_SIGS: the data is the file's chunk signatures, not its bytes
+	Session *next;
+};
+
+// a batch file the window is done reading - its panes can still point into the mapping
+struct retired
+{
+	FileSource *source;
+	int32_t dataFile;
+	uint32_t lastSeqNum;	// freed once the window's lower bound is past this
+	Retired *next;
+};
+
 // control
-void serverTransfer(int serverSock);
-void clientControl(int32_t serverSock, uint8_t *buff, int32_t recvLen, Connection *client);
+void serverTransfer(int serverSock, const CongestionOps *ccOps, int64_t paceRate);
+void acceptClient(int serverSock, int epollFd, Session **sessions, const CongestionOps *ccOps, int64_t paceRate);
+void serviceSession(Session *session, int readable);
+void runSession(Session *session, int readable);
+int64_t nextTimeout(Session *sessions);
+void reapSessions(Session **sessions);
 
 // states
-STATE filename(Connection *client, uint8_t *buff, int32_t recvLen, int32_t *dataFile, int32_t *buffSize);
-STATE sendPacket(Connection *client, uint8_t *packet, int32_t *packetLen, int32_t dataFile, int32_t buffSize, uint32_t *seqNum, int *eofSent);
-STATE handleFeedback(Connection *client, uint8_t *packet, uint32_t *seqNum);
-STATE waiter(Connection *client);
-STATE timeoutResend(Connection *client, uint8_t *packet, int32_t *packetLen, uint32_t seqNum, int *retryCnt);
-STATE waitEofAck(Connection *client, uint8_t *packet);
-STATE timeoutEofResend(Connection *client, uint8_t *packet, int32_t *packetLen, uint32_t seqNum, int *retryCnt);
-void cleanup(int32_t dataFile, Connection *client);
+STATE filename(Session *session, uint8_t *buff, int32_t recvLen, uint8_t flag);
+STATE sendPacket(Session *session);
+STATE handleFeedback(Session *session);
+STATE waiter(Session *session, int *readable);
+STATE timeoutResend(Session *session);
+STATE waitEofAck(Session *session, int *readable);
+STATE timeoutEofResend(Session *session);
+void cleanup(Session *session);
 
 // helpers
-int checkArgs(int argc, char *argv[], float *errorRate, int *portNumber);
-void reapZombies(int sig);
+int checkArgs(int argc, char *argv[], float *errorRate, int *portNumber, const CongestionOps **ccOps, int64_t *paceRate);
+void armTimer(Session *session);
+void sampleRtt(Session *session, uint32_t ackedSeqNum);
+int panesExpired(Session *session);
+uint64_t nextDeadline(Session *session);
+void sackResend(Session *session, uint8_t *sackBuff, int32_t sackLen);
+void congestionFeedback(Session *session, uint8_t flag, uint32_t seqNum, uint32_t oldLower);
+void applyCwnd(Session *session);
+int32_t nextFile(Session *session);
+void retireFile(Session *session);
+void reapRetired(Session *session, uint32_t lower);
 
 int main(int argc, char *argv[])
 {
 	int serverSock = 0;
 	int portNumber = 0;
 	float errorRate = 0;
+	const CongestionOps *ccOps = NULL;
+	int64_t paceRate = PACE_OFF;
 
-	checkArgs(argc, argv, &errorRate, &portNumber);
+	checkArgs(argc, argv, &errorRate, &portNumber, &ccOps, &paceRate);
 
 	serverSock = udpServerSetup(portNumber);
 
 	sendtoErr_init(errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON); // TODO: turn RSEED_ON for turn in
 
-	serverTransfer(serverSock);
+	serverTransfer(serverSock, ccOps, paceRate);
 
 	close(serverSock);
 
 	return 0;
 }
 
-void serverTransfer(int serverSock)
+void serverTransfer(int serverSock, const CongestionOps *ccOps, int64_t paceRate)
 {
-	// This function is the main loop for the server, it waits for clients
-	// to connect and processes their requests in a forked child process.
-	pid_t pid = 0;
-	uint8_t buff[MAX_PACK_LEN] = {0};
-	Connection *client = (Connection *)calloc(1, sizeof(Connection));
-	client->addrLen = sizeof(client->remote); // this line took me ~7 hours to find out I needed it and fix AHHHHHHH
-	uint8_t flag = 0;
-	uint32_t seqNum = 0;
-	int32_t recvLen = 0;
+	// This function is the main loop for the server. Instead of forking a child per
+	// client, every session gets its own socket and they are all multiplexed over one
+	// epoll set, new FNAME requests still arrive on serverSock.
+	struct epoll_event event = {0};
+	struct epoll_event events[MAX_EVENTS];
+	struct timespec waitTime = {0};
+	Session *sessions = NULL;
+	int64_t timeout = 0;
+	int epollFd = 0;
+	int numEvents = 0;
+
+	if ((epollFd = epoll_create1(0)) < 0)
+	{
+		perror("epoll_create1 call");
+		exit(-1);
+	}
 
-	// clean up forked children
-	signal(SIGCHLD, reapZombies);
+	// NULL data marks the main socket, every other fd points at its session
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSock, &event) < 0)
+	{
+		perror("epoll_ctl call");
+		exit(-1);
+	}
 
 	while (1)
 	{
-		// block waiting for new client
-		recvLen = recvBuff(buff, MAX_PACK_LEN, serverSock, client, &flag, &seqNum);
-		// recvLen = safeRecvfrom(socketNum, buff, sizeof(buff), 0, (struct sockaddr *)&client, &clientAddrLen);
-		if (recvLen != CRC_ERROR)
+		// epoll_pwait2 so sub-millisecond RTOs aren't rounded up to a whole ms
+		timeout = nextTimeout(sessions);
+		waitTime.tv_sec = timeout / 1000000;
+		waitTime.tv_nsec = (timeout % 1000000) * 1000;
+		if ((numEvents = epoll_pwait2(epollFd, events, MAX_EVENTS, (timeout < 0) ? NULL : &waitTime, NULL)) < 0)
 		{
-			if ((pid = fork()) < 0)
+			if (errno == EINTR) continue;
+			perror("epoll_pwait2 call");
+			exit(-1);
+		}
+
+		for (int i = 0; i < numEvents; i++)
+		{
+			if (events[i].data.ptr == NULL)
 			{
-				perror("fork failed");
-				exit(-1);
+				acceptClient(serverSock, epollFd, &sessions, ccOps, paceRate);
 			}
-			if (pid == 0)
+			else
 			{
-				// //~!*
-				// printf("Press Enter to continue into child process...\n");
-				// getchar(); // wait for user input to debug
-				// //~!*
-
-				// child process
-				printf("Child fork() - child pid: %d\n", getpid());
-				clientControl(serverSock, buff, recvLen, client);
-				exit(0);
+				serviceSession((Session *)events[i].data.ptr, 1);
 			}
 		}
+
+		// give every session a chance to send its next packet or fire its timer
+		for (Session *session = sessions; session != NULL; session = session->next)
+		{
+			serviceSession(session, 0);
+		}
+
+		reapSessions(&sessions);
 	}
 }
 
-void clientControl(int32_t serverSock, uint8_t *buff, int32_t recvLen, Connection *client)
+void acceptClient(int serverSock, int epollFd, Session **sessions, const CongestionOps *ccOps, int64_t paceRate)
 {
-	// Process each new clients request
-	STATE state = FILENAME;
+	// reads a new client's FNAME packet off the main socket and starts a session for it
+	uint8_t buff[MAX_PACK_LEN] = {0};
+	struct epoll_event event = {0};
+	uint8_t flag = 0;
+	uint32_t seqNum = 0;
+	int32_t recvLen = 0;
 
-	// uint32_t seqNum = START_SEQ_NUM;	// state machine global to keep track of the sequence number to send ::: thinking this isn't needed: ________^
+	Session *session = (Session *)sCalloc(1, sizeof(Session));
+	session->client.addrLen = sizeof(session->client.remote); // this line took me ~7 hours to find out I needed it and fix AHHHHHHH
+	session->nextToSend = START_SEQ_NUM;
+	initRtt(&session->rtt);
 
-	uint32_t nextToSend = START_SEQ_NUM; // next sequence number to send, used for FSM global next seqNum to send
-	int eofSent = 0;
-	static int retryCnt = 0;
+	recvLen = recvBuff(buff, MAX_PACK_LEN, serverSock, &session->client, &flag, &seqNum);
+	if (recvLen == CRC_ERROR || (flag != FNAME && flag != FNAME_LIST && flag != FNAME_SIGS))
+	{
+		free(session);
+		return;
+	}
 
-	int32_t dataFile = 0;
-	int32_t packetLen = 0;
-	uint8_t packet[MAX_PACK_LEN] = {0};
-	int32_t buffSize = 0;
+	if ((session->state = filename(session, buff, recvLen, flag)) == DONE)
+	{
+		cleanup(session);
+		return;
+	}
+	initCongestion(&session->cc, ccOps, session->win->winSize);
+	session->paceRate = paceRate;
+	initPacer(&session->pacer, (paceRate > 0) ? (uint64_t)paceRate : 0);
+	applyCwnd(session);
 
-	while (state != DONE)
+	event.events = EPOLLIN;
+	event.data.ptr = session;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, session->client.socketNum, &event) < 0)
 	{
-		switch (state)
-		{
-			case FILENAME:
-				state = filename(client, buff, recvLen, &dataFile, &buffSize);
-				break;
+		perror("epoll_ctl call");
+		cleanup(session);
+		return;
+	}
+
+	session->next = *sessions;
+	*sessions = session;
+}
 
+void serviceSession(Session *session, int readable)
+{
+	// Panes point straight into the mapped source file, so a file cut short mid transfer
+	// raises SIGBUS when one of them is summed or sent. Only the session reading it is dropped.
+	sigjmp_buf busGuard;
+
+	if (sigsetjmp(busGuard, 1) != 0)
+	{
+		fprintf(stderr, "Error: source file shrank under the session on socket %d, dropping it.\n", session->client.socketNum);
+		session->state = DONE;
+	}
+	else
+	{
+		guardSource(&busGuard);
+		runSession(session, readable);
+	}
+	guardSource(NULL);
+}
+
+void runSession(Session *session, int readable)
+{
+	// Runs one session's FSM until it has to wait on its socket or timer. At most one
+	// burst (the open part of the window) is sent per call so a single fast transfer
+	// can't starve the others.
+	int sent = 0;
+
+	while (session->state != DONE)
+	{
+		if (session->win->sendFailed)
+		{
+			session->state = DONE;	// a send to rcopy failed, drop only this session
+			break;
+		}
+		switch (session->state)
+		{
 			case SEND_PACKET:
-				if (!eofSent)
+				if (sent)
+				{
+					return; // come back on the next pass of the event loop
+				}
+				if (!session->eofSent)
 				{
-					state = sendPacket(client, packet, &packetLen, dataFile, buffSize, &nextToSend, &eofSent);
+					session->state = sendPacket(session);
+					sent = 1;
 				}
 				else
 				{
-					state = WAIT_EOF_ACK; // if EOF sent, wait for ACK
+					session->state = WAIT_EOF_ACK; // if EOF sent, wait for ACK
 				}
 				break;
 
 			case WAITER:
-				state = waiter(client);
+				if ((session->state = waiter(session, &readable)) == WAITER)
+				{
+					return;
+				}
 				break;
 
 			case HANDLE_FEEDBACK:
-				state = handleFeedback(client, packet, &nextToSend);
+				session->state = handleFeedback(session);
 				break;
 
 			case TIMEOUT_RESEND:
-				state = timeoutResend(client, packet, &packetLen, getLowerBound(), &retryCnt);	// is this getLowerBound usage right here and below??
+				session->state = timeoutResend(session);
 				break;
 
 			case WAIT_EOF_ACK:
-				state = waitEofAck(client, packet);
+				if ((session->state = waitEofAck(session, &readable)) == WAIT_EOF_ACK)
+				{
+					return;
+				}
 				break;
 
 			case TIMEOUT_EOF_RESEND:
-				state = timeoutEofResend(client, packet, &packetLen, getLowerBound(), &retryCnt);
+				session->state = timeoutEofResend(session);
 				break;
 
-			case DONE:
-				break;
-			
 			default:
-				printf("ERROR - In default state, this is bad.. (clientControl)\n");
-				state = DONE;
+				printf("ERROR - In default state, this is bad.. (serviceSession)\n");
+				session->state = DONE;
 				break;
 		}
 	}
+}
+
+int64_t nextTimeout(Session *sessions)
+{
+	// returns the epoll wait in us: 0 if any session can send right now,
+	// otherwise the time until the nearest session timer, -1 if there are no sessions
+	uint64_t now = getTimeUs();
+	int64_t timeout = -1;
 
-	// DONE State
-	cleanup(dataFile, client);
+	for (Session *session = sessions; session != NULL; session = session->next)
+	{
+		uint64_t deadline = nextDeadline(session);
+		if (session->state == SEND_PACKET || deadline <= now)
+		{
+			return 0;
+		}
+		if (deadline != UINT64_MAX && (timeout < 0 || deadline - now < (uint64_t)timeout))
+		{
+			timeout = (int64_t)(deadline - now);
+		}
+	}
+	return timeout;
 }
 
-STATE filename(Connection *client, uint8_t *buff, int32_t recvLen,
-			   int32_t *dataFile, int32_t *buffSize)
+void reapSessions(Session **sessions)
 {
-	uint8_t response[1];
-	char fname[MAX_FNAME_LEN] = {0};
-	STATE retVal = DONE;
-	uint32_t winSize = 0;
+	// unlinks and frees every session that reached DONE
+	Session **link = sessions;
 
-	if (DEBUG_FLAG && ((recvLen - BUFF_SIZE) > 100))
+	while (*link != NULL)
 	{
-		fprintf(stderr, "FNAME_ERROR: filename is greater than 100 characters, this should never happen!\n");
-		return DONE;
+		Session *session = *link;
+		if (session->state == DONE)
+		{
+			*link = session->next;
+			cleanup(session);
+		}
+		else
+		{
+			link = &session->next;
+		}
 	}
+}
+
+STATE filename(Session *session, uint8_t *buff, int32_t recvLen, uint8_t flag)
+{
+	Connection *client = &session->client;
+	int32_t *dataFile = &session->dataFile;
+	int32_t *buffSize = &session->buffSize;
+	uint8_t response[FILE_SIZE_LEN] = {0};
+	char fname[MAX_FNAME_LEN] = {0};
+	STATE retVal = DONE;
+	uint32_t winSize = 0;
+	int32_t nameLen = 0;
+	uint8_t *nameEnd = NULL;
+	off_t spans[2 * MAX_SPANS];
+	uint64_t largest = 0;
+	int ranged = 0;		// byte ranges in the FNAME, 0 = the whole file
+	int32_t tailLen = 0;
+	struct stat st;
 
 	if (client->addrLen > sizeof(client->remote))
 	{
@@ -231,10 +414,68 @@ STATE filename(Connection *client, uint8_t *buff, int32_t recvLen,
 		fprintf(stderr, "FNAME_ERROR: recvLen is less than 8 bytes or greater than %d bytes, this should never happen!\n", MAX_PACK_LEN);
 		return DONE;
 	}
-	memcpy(fname, &buff[2 * BUFF_SIZE], recvLen - BUFF_SIZE); // <~!*> (recvLen - 2 * BUFF_SIZE) should never be larger than MAX_FNAME_LEN
-	fname[recvLen - WIN_BUFF_LEN] = '\0';
+	// the name runs to the end of the PDU, or to a '\0' with the byte range of one stream (or a
+	// delta's several) after it and maybe the codec byte, a batch's names to a '\0' with only the codec byte
+	nameLen = recvLen - WIN_BUFF_LEN;
+	session->sigs = (flag == FNAME_SIGS);
+	if (flag == FNAME_LIST)
+	{
+		if ((nameEnd = memchr(&buff[WIN_BUFF_LEN], '\0', nameLen)) != NULL)
+		{
+			if (nameLen - (nameEnd - &buff[WIN_BUFF_LEN]) - 1 != CODEC_LEN)
+			{
+				fprintf(stderr, "FNAME_ERROR: batch codec is %d bytes instead of %d\n", (int)(nameLen - (nameEnd - &buff[WIN_BUFF_LEN]) - 1), CODEC_LEN);
+				return DONE;
+			}
+			session->codec = nameEnd[1];
+			nameLen = nameEnd - &buff[WIN_BUFF_LEN];
+		}
+		// a batch: the files are opened one after another as sendPacket() gets to them
+		session->batch = (char *)sCalloc(nameLen + 1, 1);
+		memcpy(session->batch, &buff[WIN_BUFF_LEN], nameLen);
+		session->nextName = session->batch;
+		nameLen = 0;
+	}
+	else if ((nameEnd = memchr(&buff[WIN_BUFF_LEN], '\0', nameLen)) != NULL)
+	{
+		tailLen = nameLen - (nameEnd - &buff[WIN_BUFF_LEN]) - 1;
+		if (tailLen < RANGE_LEN || (tailLen % RANGE_LEN != 0 && tailLen % RANGE_LEN != CODEC_LEN))
+		{
+			fprintf(stderr, "FNAME_ERROR: byte ranges are %d bytes, not a multiple of %d\n", tailLen, RANGE_LEN);
+			return DONE;
+		}
+		if (tailLen % RANGE_LEN == CODEC_LEN)
+		{
+			session->codec = nameEnd[tailLen];
+		}
+		nameLen = nameEnd - &buff[WIN_BUFF_LEN];
+		for (ranged = 0; ranged < tailLen / RANGE_LEN; ranged++)
+		{
+			uint64_t offset = 0;
+			uint64_t length = 0;
+			memcpy(&offset, &nameEnd[1 + ranged * RANGE_LEN], sizeof(offset));
+			memcpy(&length, &nameEnd[1 + ranged * RANGE_LEN + sizeof(offset)], sizeof(length));
+			offset = be64toh(offset);
+			length = be64toh(length);
+			largest = (offset > largest) ? offset : largest;
+			largest = (length > largest) ? length : largest;
+			spans[2 * ranged] = (off_t)offset;
+			spans[2 * ranged + 1] = (off_t)length;
+		}
+	}
+	if (nameLen >= MAX_FNAME_LEN || largest > INT64_MAX)
+	{
+		fprintf(stderr, "FNAME_ERROR: filename is greater than %d characters or the range is too big\n", MAX_FNAME_LEN - 1);
+		return DONE;
+	}
+	memcpy(fname, &buff[WIN_BUFF_LEN], nameLen);
+	fname[nameLen] = '\0';
+	if (DEBUG_FLAG && ranged)
+	{
+		printf("{DEBUG} Range: %lld bytes from offset %lld, %d range(s)\n", (long long)spans[1], (long long)spans[0], ranged);
+	}
 
-	//~!* - create client socket for each particular client within child server
+	//~!* - create client socket for each particular client session
 	client->socketNum = safeGetUdpSocket();
 
 	if (DEBUG_FLAG)
@@ -264,67 +505,126 @@ STATE filename(Connection *client, uint8_t *buff, int32_t recvLen,
 	printf("\n{DEBUG} Client connected from [%s]:%d\n\n", addrStr, port);
 	//~!*
 	
-	// if fname found send fname ok flag, else send fname bad flag
-	if (((*dataFile) = open(fname, O_RDONLY)) < 0)
+	// if fname found send fname ok flag with the file's size, else send fname bad flag
+	// a batch has no size, each of its files gets a NEXT_FILE saying if it opened. A codec this
+	// server doesn't have is refused the same way, rcopy can ask again without one. So is a window
+	// the SACK bitmap can't cover or a buffer bigger than a packet, every other session shares this process
+	if (winSize < 1 || winSize > SACK_MAP_LEN * 8 || *buffSize < 1 || *buffSize > MAX_PAYLOAD)
+	{
+		fprintf(stderr, "FNAME_ERROR: window size %u or buffer size %d is out of range\n", winSize, *buffSize);
+		sendBuff(response, 0, client, FNAME_BAD, 0, buff);
+		retVal = DONE;
+	}
+	else if (session->codec > CODEC_LZ4 ||
+		(session->batch == NULL && ((*dataFile) = open(fname, O_RDONLY)) < 0))
+	{
+		sendBuff(response, 0, client, FNAME_BAD, 0, buff);
+		retVal = DONE;
+	}
+	else if ((session->batch == NULL &&
+			  (session->source = ranged ? initFileSpans(*dataFile, spans, ranged) : initFileSource(*dataFile, 0, SOURCE_TO_EOF)) == NULL) ||
+			 (session->win = initWindow(winSize, *buffSize)) == NULL)
 	{
 		sendBuff(response, 0, client, FNAME_BAD, 0, buff);
 		retVal = DONE;
 	}
 	else
 	{
-		sendBuff(response, 0, client, FNAME_OK, 0, buff);
-		initWindow(winSize, *buffSize);
-		retVal = SEND_PACKET;
+		uint64_t fileSize = (session->batch == NULL && fstat(*dataFile, &st) == 0 && S_ISREG(st.st_mode)) ? htobe64((uint64_t)st.st_size) : 0;
+		memcpy(response, &fileSize, FILE_SIZE_LEN);
+		retVal = (sendBuff(response, FILE_SIZE_LEN, client, FNAME_OK, 0, buff) < 0) ? DONE : SEND_PACKET;
 	}
 	return retVal;
 }
 
-STATE sendPacket(Connection *client, uint8_t *packet, int32_t *packetLen,
-               int32_t dataFile, int32_t buffSize, uint32_t *seqNum,
-			   int *eofSent)
+STATE sendPacket(Session *session)
 {
-	if (windowOpen())
+	// burst mode - fill every open pane from the file, then push them all out in one sendmmsg()
+	uint32_t firstSeqNum = session->nextToSend;
+	uint32_t allowance = pacerAllowance(&session->pacer, getTimeUs());
+	int32_t lenRead = 1;
+
+	if (!windowOpen(session->win) || allowance == 0)
+	{
+		return WAITER; // if window is closed wait for ACK or SREJ, if the pacer is empty wait for tokens
+	}
+
+	while (windowOpen(session->win) == 1 && session->nextToSend - firstSeqNum < allowance)
 	{
-		uint8_t dataBuff[MAX_PAYLOAD] = {0};
-		int32_t lenRead = read(dataFile, dataBuff, buffSize);
-		if (lenRead == 0)
+		// the pane points straight at the mapped file, or at its own buffer on the read() fallback
+		// and when a codec packs the file into it
+		const uint8_t *payload = NULL;
+		lenRead = 0;
+		if (session->source != NULL && session->sigs)
 		{
-			// EOF reached
-			*packetLen = sendBuff(dataBuff, 1, client, END_OF_FILE, *seqNum, packet);
-			(*seqNum)++;
-			*eofSent = 1;
-			return WAIT_EOF_ACK;
+			lenRead = readSigs(session->source, getPaneBuff(session->win), session->buffSize);
 		}
-		else if (lenRead < 0)
+		else if (session->source != NULL && session->codec != CODEC_NONE)
 		{
-			perror("sendPacket, read on file error");
-			return DONE;
+			lenRead = readPacked(session->source, session->codec, getPaneBuff(session->win), session->buffSize);
 		}
-		else
-		{	// normal sending case
-			addPane(dataBuff, lenRead, *seqNum);
-			*packetLen = sendBuff(dataBuff, lenRead, client, DATA, *seqNum, packet);
-			(*seqNum)++;
-			return WAITER;
+		else if (session->source != NULL)
+		{
+			lenRead = readSource(session->source, getPaneBuff(session->win), session->buffSize, &payload);
+		}
+		if (lenRead == 0 && (lenRead = nextFile(session)) > 0)
+		{
+			continue; // a batch's next file starts, its NEXT_FILE took this pane
+		}
+		if (lenRead <= 0)
+		{
+			break;
 		}
+		addPaneSlice(session->win, lenRead, session->nextToSend, payload);
+		session->nextToSend++;
+	}
+
+	if (lenRead < 0)
+	{
+		perror("sendPacket, read on file error");
+		return DONE;
+	}
+
+	if (session->nextToSend > firstSeqNum)
+	{	// normal sending case, sendPanes() starts each pane's retransmit timer
+		sendPanes(session->win, &session->client, DATA, firstSeqNum, session->nextToSend - firstSeqNum);
+		pacerConsume(&session->pacer, session->nextToSend - firstSeqNum);
 	}
-	else return WAITER; // if window is closed, wait for ACK or SREJ
+
+	if (lenRead == 0)
+	{
+		// EOF reached
+		uint8_t packet[MAX_PACK_LEN] = {0};
+		if (sendInPlace(packet, 1, &session->client, END_OF_FILE, session->nextToSend) < 0)
+		{
+			return DONE;
+		}
+		session->nextToSend++;
+		session->eofSent = 1;
+		armTimer(session);
+		return WAIT_EOF_ACK;
+	}
+	return WAITER;
 }
 
-STATE waiter(Connection *client)
+STATE waiter(Session *session, int *readable)
 {
-	int pollTime = (!windowOpen()) ? SHORT_TIME : 0;
-	if (selectCall(client->socketNum, pollTime, 0) == 1)
+	if (*readable)
 	{
+		*readable = 0;
 		return HANDLE_FEEDBACK; // rcopy responded with ACK or SREJ
 	}
-	else if (pollTime == SHORT_TIME)
+	else if (windowOpen(session->win) && pacerAllowance(&session->pacer, getTimeUs()) > 0)
+	{
+		return SEND_PACKET; // window is open and the pacer has tokens, ready to send next packet
+	}
+	else if (panesExpired(session))
 	{
-		return TIMEOUT_RESEND; // no response, timeout and resend
+		return TIMEOUT_RESEND; // a pane went a whole RTO without feedback, resend it
 	}
 	else
 	{
-		return SEND_PACKET; // window is open, ready to send next packet
+		return WAITER; // window closed, keep waiting on the socket or timer
 	}
 }
 
@@ -363,38 +663,49 @@ STATE waiter(Connection *client)
 // 	return retVal;
 // }
 
-STATE handleFeedback(Connection *client, uint8_t *packet, uint32_t *seqNum)
+STATE handleFeedback(Session *session)
 {
 	uint8_t flag = 0;
 	uint32_t ackSeqNum = 0;
-	uint8_t nullBuff[MAX_PAYLOAD] = {0};
-	int32_t recvLen = recvBuff(nullBuff, MAX_PACK_LEN, client->socketNum, client, &flag, &ackSeqNum);
+	uint8_t nullBuff[MAX_PACK_LEN] = {0};
+	int32_t recvLen = recvBuff(nullBuff, MAX_PACK_LEN, session->client.socketNum, &session->client, &flag, &ackSeqNum);
 	if (recvLen == CRC_ERROR)
 	{
 		if (DEBUG_FLAG)
 			printf("{ERROR} handleFeedback: CRC error on feedback packet, ignoring.\n");
 		return WAITER; // ignore crc errors
 	}
+	uint32_t oldLower = getLowerBound(session->win);
+	resetBackoff(&session->rtt); // rcopy is still there
+	if (flag == ACK_RR || flag == SACK)
+	{
+		sampleRtt(session, (flag == SACK) ? ackSeqNum - 1 : ackSeqNum); // SACK's seqNum is its base
+	}
 	if (flag == ACK_RR)
 	{
 		// markPaneAck(ackSeqNum);	// DONT THINK THIS IS EVEN NEEDED
-		slideWindow(ackSeqNum + 1);
-		*seqNum = getCurrSeqNum();
+		slideWindow(session->win, ackSeqNum + 1);
+		session->nextToSend = getCurrSeqNum(session->win);
 		// *seqNum = ackSeqNum + 1; // update server state global to next packet
 	}
 	else if (flag == SREJ)
 	{
-		resendPane(client, SREJ_DATA, ackSeqNum, packet);
+		resendPane(session->win, &session->client, SREJ_DATA, ackSeqNum);
+	}
+	else if (flag == SACK)
+	{
+		sackResend(session, nullBuff, recvLen);
 	}
 	else if (flag == EOF_ACK)
 	{
 		return DONE;
 	}
-	else if (flag != ACK_RR && flag != SREJ && flag != EOF_ACK)
+	else
 	{
-		printf("{ERROR} In handleFeedback but its not an ACK_RR or SREJ or EOF_ACK flag (this should never happen) is: %d\n", flag);
+		printf("{ERROR} In handleFeedback but its not an ACK_RR, SREJ, SACK or EOF_ACK flag (this should never happen) is: %d\n", flag);
 		return DONE;
 	}
+	congestionFeedback(session, flag, ackSeqNum, oldLower);
 	return SEND_PACKET;
 }
 
@@ -427,20 +738,27 @@ STATE handleFeedback(Connection *client, uint8_t *packet, uint32_t *seqNum)
 // 	}
 // }
 
-STATE waitEofAck(Connection *client, uint8_t *packet)
+STATE waitEofAck(Session *session, int *readable)
 {
-	if (selectCall(client->socketNum, SHORT_TIME, 0))
+	if (*readable)
 	{
 		uint8_t flag = 0;
 		uint32_t ackSeqNum = 0;
-		uint8_t nullBuff[MAX_PAYLOAD] = {0};
-		int32_t recvLen = recvBuff(nullBuff, MAX_PACK_LEN, client->socketNum, client, &flag, &ackSeqNum);	// try NULL recvs for the rest of the states
+		uint8_t nullBuff[MAX_PACK_LEN] = {0};
+		*readable = 0;
+		int32_t recvLen = recvBuff(nullBuff, MAX_PACK_LEN, session->client.socketNum, &session->client, &flag, &ackSeqNum);	// try NULL recvs for the rest of the states
 		if (recvLen == CRC_ERROR)
 		{
 			if (DEBUG_FLAG)
 				printf("{ERROR} waitEofAck: CRC error on EOF ACK packet, ignoring.\n");
 			return WAIT_EOF_ACK; // ignore crc errors
 		}
+		resetBackoff(&session->rtt);
+		if (flag == ACK_RR || flag == SACK)
+		{
+			sampleRtt(session, (flag == SACK) ? ackSeqNum - 1 : ackSeqNum);
+		}
+		armTimer(session);
 		if (flag == EOF_ACK)
 		{
 			return DONE;
@@ -448,17 +766,30 @@ STATE waitEofAck(Connection *client, uint8_t *packet)
 		else if (flag == ACK_RR)
 		{
 			// markPaneAck(ackSeqNum);	// DONT THINK THIS IS EVEN NEEDED
-			slideWindow(ackSeqNum + 1);
+			slideWindow(session->win, ackSeqNum + 1);
 			return SEND_PACKET;
 		}
 		else if (flag == SREJ)
 		{
-			resendPane(client, SREJ_DATA, ackSeqNum, packet);
+			resendPane(session->win, &session->client, SREJ_DATA, ackSeqNum);
+			return WAIT_EOF_ACK;
+		}
+		else if (flag == SACK)
+		{
+			sackResend(session, nullBuff, recvLen);
 			return WAIT_EOF_ACK;
 		}
 		return WAIT_EOF_ACK;
 	}
-	else return TIMEOUT_EOF_RESEND;
+	else if (panesExpired(session))
+	{
+		return TIMEOUT_RESEND; // panes still unACKed behind EOF keep their own timers
+	}
+	else if (getTimeUs() >= session->deadline)
+	{
+		return TIMEOUT_EOF_RESEND;
+	}
+	else return WAIT_EOF_ACK;
 }
 
 
@@ -504,16 +835,20 @@ STATE waitEofAck(Connection *client, uint8_t *packet)
 // 	return retVal;
 // }
 
-STATE timeoutResend(Connection *client, uint8_t *packet, int32_t *packetLen, uint32_t seqNum, int *retryCnt)
+STATE timeoutResend(Session *session)
 {
-	if (*retryCnt >= MAX_TRIES)
+	uint64_t cutoff = getTimeUs() - getRto(&session->rtt); // panes sent at or before this have expired
+
+	if (backoffRtt(&session->rtt) < 0)
 	{
-		return DONE;
+		return DONE; // rcopy has been quiet for about LONG_TIME seconds
 	}
-	*packetLen = resendPane(client, TIMEOUT_DATA, seqNum, packet);
-	(*retryCnt)++;
+	// every expired pane goes out, not just the lowest, and gets the doubled timeout
+	resendExpired(session->win, &session->client, TIMEOUT_DATA, cutoff);
+	ccTimeout(&session->cc, getCurrSeqNum(session->win));
+	applyCwnd(session);
 
-	return WAITER;
+	return session->eofSent ? WAIT_EOF_ACK : WAITER;
 }
 
 // 	int32_t sentPacketLen = resendPane(client, TIMEOUT_DATA, *seqNum, packet);
@@ -526,43 +861,153 @@ STATE timeoutResend(Connection *client, uint8_t *packet, int32_t *packetLen, uin
 // 	return WAITER;
 // }
 
-STATE timeoutEofResend(Connection *client, uint8_t *packet, int32_t *packetLen, uint32_t seqNum, int *retryCnt)
+STATE timeoutEofResend(Session *session)
 {
-	if (*retryCnt >= MAX_TRIES)
+	if (backoffRtt(&session->rtt) < 0)
+	{
+		return DONE;
+	}
+	uint8_t packet[MAX_PACK_LEN] = {0};
+	if (sendInPlace(packet, 1, &session->client, END_OF_FILE, session->nextToSend - 1) < 0)	// EOF keeps its own seqNum
 	{
 		return DONE;
 	}
-	uint8_t dataBuff[MAX_PAYLOAD] = {0};
-	*packetLen = sendBuff(dataBuff, 1, client, END_OF_FILE, seqNum, packet);
-	(*retryCnt)++;
+	armTimer(session);
 	return WAIT_EOF_ACK;
 }
 
-void cleanup(int32_t dataFile, Connection *client)
+void cleanup(Session *session)
 {
-	if (dataFile > 0)
+	if (session->dataFile > 0)
+	{
+		close(session->dataFile);
+	}
+	if (session->win != NULL)
 	{
-		close(dataFile);
+		freeWindow(session->win);
 	}
-	freeWindow();
-	if (client->socketNum > 0)
+	freeFileSource(session->source);	// after the window, its panes point into the mapping
+	reapRetired(session, UINT32_MAX);
+	free(session->batch);
+	if (session->client.socketNum > 0)
+	{
+		close(session->client.socketNum);	// closing also drops it from the epoll set
+	}
+	free(session);	// free each session's struct
+}
+
+// batch sessions: retires the file that just ran out and opens the next one on the list, queuing
+// a NEXT_FILE pane [index (4 bytes)] [1 = opened, 0 = skipped] in front of its data - returns the
+// pane's length, 0 once the list is done (always for a single file) or -1 on error
+int32_t nextFile(Session *session)
+{
+	uint8_t *pane = getPaneBuff(session->win);
+	char *name = session->nextName;
+	char *end = NULL;
+	uint32_t index = htonl(session->fileIndex);
+
+	if (name == NULL)
+	{
+		return 0;
+	}
+	if (pane == NULL)
+	{
+		fprintf(stderr, "Error: nextFile called with the window closed.\n");
+		return -1;
+	}
+	retireFile(session);
+	reapRetired(session, getLowerBound(session->win));
+
+	if ((end = strchr(name, '\n')) != NULL)
+	{
+		*end = '\0';
+		session->nextName = end + 1;
+	}
+	else
+	{
+		session->nextName = NULL;
+	}
+
+	// a file that won't open is skipped, rcopy reports it and the batch goes on
+	if ((session->dataFile = open(name, O_RDONLY)) >= 0 &&
+		(session->source = initFileSource(session->dataFile, 0, SOURCE_TO_EOF)) == NULL)
+	{
+		close(session->dataFile);
+		session->dataFile = -1;
+	}
+	if (DEBUG_FLAG)
+	{
+		printf("{DEBUG} Batch file %u: %s%s\n", session->fileIndex, name, (session->source != NULL) ? "" : " (skipped)");
+	}
+
+	memcpy(pane, &index, sizeof(index));
+	pane[sizeof(index)] = (session->source != NULL);
+	if (addPane(session->win, NEXT_FILE_LEN, session->nextToSend) < 0 ||
+		setPaneFlag(session->win, session->nextToSend, NEXT_FILE) < 0)
+	{
+		return -1;
+	}
+	session->fileIndex++;
+	session->nextToSend++;
+	return NEXT_FILE_LEN;
+}
+
+// moves the current batch file onto the retired list, its mapping stays until the panes
+// sent from it are ACKed
+void retireFile(Session *session)
+{
+	if (session->source == NULL && session->dataFile <= 0)
+	{
+		return;
+	}
+	Retired *retired = (Retired *)sCalloc(1, sizeof(Retired));
+	retired->source = session->source;
+	retired->dataFile = session->dataFile;
+	retired->lastSeqNum = session->nextToSend - 1;
+	retired->next = session->retired;
+	session->retired = retired;
+	session->source = NULL;
+	session->dataFile = 0;
+}
+
+// frees every retired file whose panes all sit below lower
+void reapRetired(Session *session, uint32_t lower)
+{
+	Retired **link = &session->retired;
+
+	while (*link != NULL)
 	{
-		close(client->socketNum);
+		Retired *retired = *link;
+		if (retired->lastSeqNum < lower)
+		{
+			*link = retired->next;
+			freeFileSource(retired->source);
+			if (retired->dataFile > 0)
+			{
+				close(retired->dataFile);
+			}
+			free(retired);
+		}
+		else
+		{
+			link = &retired->next;
+		}
 	}
-	free(client);	// free each child's Connection struct
 }
 
-// usage: server <error rate> [port number]
-int checkArgs(int argc, char *argv[], float *errorRate, int *portNumber)
+// usage: server <error rate> [port number] [congestion control] [pacing]
+int checkArgs(int argc, char *argv[], float *errorRate, int *portNumber, const CongestionOps **ccOps, int64_t *paceRate)
 {
 	// Checks args and returns port number
 	int status = 0;
 	*portNumber = 0;
 	*errorRate = 0;
+	*ccOps = findCongestionOps("none");
+	*paceRate = PACE_OFF;
 
-	if (argc < 2 || argc > 3)
+	if (argc < 2 || argc > 5)
 	{
-		fprintf(stderr, "Usage %s <error rate> [optional port number]\n", argv[0]);
+		fprintf(stderr, "Usage %s <error rate> [optional port number] [optional congestion control: none|newreno] [optional pacing: off|auto|packets per second]\n", argv[0]);
 		exit(-1);
 	}
 
@@ -572,17 +1017,135 @@ int checkArgs(int argc, char *argv[], float *errorRate, int *portNumber)
 		fprintf(stderr, "Error rate must be between 0 and less than 1\n");
 		exit(-1);
 	}
-	if (argc == 3)
+	if (argc >= 3)
 	{
 		*portNumber = atoi(argv[2]);
 	}
+	if (argc >= 4 && (*ccOps = findCongestionOps(argv[3])) == NULL)
+	{
+		fprintf(stderr, "Unknown congestion control %s, use none or newreno\n", argv[3]);
+		exit(-1);
+	}
+	if (argc == 5)
+	{
+		if (strcmp(argv[4], "auto") == 0)
+		{
+			*paceRate = PACE_AUTO;
+		}
+		else if (strcmp(argv[4], "off") != 0 && (*paceRate = atoll(argv[4])) <= 0)
+		{
+			fprintf(stderr, "Pacing must be off, auto or a rate in packets per second\n");
+			exit(-1);
+		}
+	}
 
 	return status;
 }
 
-// SIGCHLD handler to reap zombies
-void reapZombies(int sig)
+// (re)start the session's wait for EOF_ACK, one RTO (backoff included) from now
+void armTimer(Session *session)
 {
-	int status = 0;
-	while (waitpid(-1, &status, WNOHANG) > 0);
+	session->deadline = getTimeUs() + getRto(&session->rtt);
+}
+
+// time the pane an ACK_RR or SACK just covered and fold it into the session's RTO
+// must run before the window slides past it
+void sampleRtt(Session *session, uint32_t ackedSeqNum)
+{
+	uint64_t sample = getPaneRtt(session->win, ackedSeqNum);
+	if (sample > 0)
+	{
+		updateRtt(&session->rtt, sample);
+	}
+}
+
+// 1 if the oldest unACKed pane has gone a whole RTO since it was last sent
+int panesExpired(Session *session)
+{
+	uint64_t oldest = getOldestSendTime(session->win);
+
+	return oldest > 0 && getTimeUs() >= oldest + getRto(&session->rtt);
+}
+
+// when the session next has to wake up on its own: the first pane timer to expire, or the EOF
+// timer once EOF is out - UINT64_MAX if nothing is running
+uint64_t nextDeadline(Session *session)
+{
+	uint64_t oldest = getOldestSendTime(session->win);
+	uint64_t deadline = UINT64_MAX;
+
+	if (oldest > 0)
+	{
+		deadline = oldest + getRto(&session->rtt);
+	}
+	if (session->eofSent && session->deadline < deadline)
+	{
+		deadline = session->deadline;
+	}
+	else if (!session->eofSent && windowOpen(session->win))
+	{
+		uint64_t paced = pacerNextSend(&session->pacer); // window open but out of tokens
+		if (paced > 0 && paced < deadline)
+		{
+			deadline = paced;
+		}
+	}
+	return deadline;
+}
+
+// SACK carries rcopy's cumulative ACK (base - 1) plus a bitmap of what it buffered past base,
+// slide up to base then resend every hole in one pass
+void sackResend(Session *session, uint8_t *sackBuff, int32_t sackLen)
+{
+	uint32_t base = 0;
+
+	if (sackLen < (int32_t)sizeof(base))
+	{
+		printf("{ERROR} sackResend: SACK too short (%d bytes), ignoring.\n", sackLen);
+		return;
+	}
+	memcpy(&base, sackBuff, sizeof(base));
+	base = ntohl(base);
+
+	if (base > getLowerBound(session->win) && base <= getCurrSeqNum(session->win))
+	{
+		slideWindow(session->win, base);
+	}
+	resendMissing(session->win, &session->client, SREJ_DATA, base, &sackBuff[sizeof(base)], sackLen - sizeof(base));
+}
+
+// hand the controller what one feedback packet said: panes newly covered by the cumulative ACK,
+// and a hole for SREJ or SACK (a SACK's seqNum is its first hole) - oldLower is the window's
+// lower bound before the packet was handled
+void congestionFeedback(Session *session, uint8_t flag, uint32_t seqNum, uint32_t oldLower)
+{
+	uint32_t lower = getLowerBound(session->win);
+
+	if (lower > oldLower)
+	{
+		ccAck(&session->cc, lower - oldLower, lower, session->rtt.srtt);
+	}
+	if (flag == SREJ || flag == SACK)
+	{
+		ccLoss(&session->cc, seqNum, getCurrSeqNum(session->win));
+	}
+	applyCwnd(session);
+}
+
+// push the controller's cwnd into the window so windowOpen() honours it, and into the pacer's
+// rate when pacing is derived from cwnd/SRTT
+void applyCwnd(Session *session)
+{
+	uint32_t cwnd = getCwnd(&session->cc);
+
+	if (session->paceRate == PACE_AUTO)
+	{
+		setPacingRate(&session->pacer, derivePacingRate(cwnd, session->rtt.srtt, cwnd < session->cc.ssthresh));
+	}
+
+	if (DEBUG_FLAG && cwnd != session->win->limit)
+	{
+		printf("{DEBUG} cwnd %u -> %u (ssthresh %u)\n", session->win->limit, cwnd, session->cc.ssthresh);
+	}
+	setWindowLimit(session->win, cwnd);
 }
@@ -0,0 +1,64 @@
+// Slab allocation for the rcopy Project 3 Networks 464 class window and buffer
+
+#include <sys/mman.h>
+
+#include "slab.h"
+
+// func defs start
+
+// SLAB_HUGEPAGES tries MAP_HUGETLB first (needs vm.nr_hugepages), then asks for transparent
+// hugepages on a normal mapping, slabs under 2 MiB always use normal pages
+uint8_t *allocSlab(size_t len, size_t *mapLen)
+{
+    void *slab = MAP_FAILED;
+
+    if (len == 0 || mapLen == NULL)
+    {
+        fprintf(stderr, "Error: Invalid parameters for allocSlab.\n");
+        return NULL;
+    }
+
+    if (SLAB_HUGEPAGES && len >= SLAB_HUGE_LEN)
+    {
+        *mapLen = (len + SLAB_HUGE_LEN - 1) & ~(size_t)(SLAB_HUGE_LEN - 1);
+        slab = mmap(NULL, *mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (slab == MAP_FAILED)
+    {
+        *mapLen = len;
+        slab = mmap(NULL, *mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED)
+        {
+            perror("allocSlab, mmap");
+            return NULL;
+        }
+        if (SLAB_HUGEPAGES && len >= SLAB_HUGE_LEN)
+        {
+            madvise(slab, *mapLen, MADV_HUGEPAGE); // only a hint, THP may be off
+        }
+    }
+    return (uint8_t *)slab;
+}
+
+// self explanatory
+void freeSlab(uint8_t *slab, size_t mapLen)
+{
+    if (slab != NULL)
+    {
+        munmap(slab, mapLen);
+    }
+}
+
+// smallest power of two >= n, n is at most MAX_PANES/MAX_PACKS (2^30)
+uint32_t ringSize(uint32_t n)
+{
+    uint32_t size = 1;
+
+    while (size < n)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+// func defs end
@@ -0,0 +1,28 @@
+// written by Lukas Shipley
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifndef SLAB_HUGEPAGES
+#define SLAB_HUGEPAGES 0 // 1 = back slabs with 2 MiB hugepages when there are any, set from the Makefile
+#endif
+#define SLAB_ALIGN 64   // cache line, every metadata array and packet slot starts on one
+#define SLAB_HUGE_LEN (2 << 20)
+
+#define SLAB_ROUND(len) (((len) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+// one zeroed, page aligned mapping for a Window or PacketBuffer - its metadata arrays sit at the
+// front and the fixed stride packet slots after them, so setup is one mmap() and not a calloc()
+// per pane - returns NULL on error, *mapLen gets what to hand freeSlab()
+uint8_t *allocSlab(size_t len, size_t *mapLen);
+void freeSlab(uint8_t *slab, size_t mapLen);
+
+uint32_t ringSize(uint32_t n); // n rounded up to a power of two so ring slots are seqNum & (size - 1)
+
+#endif
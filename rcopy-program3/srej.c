@@ -6,37 +6,91 @@
 int32_t sendBuff(uint8_t * buff, uint32_t len, Connection * connection,
                   uint8_t flag, uint32_t seqNum, uint8_t * packet)
 {
-    int32_t sentLen = 0;
+    // set up packet (seq#, crc, flag, data), the data is summed while it is copied in
+    uint16_t payloadSum = 0;
     int32_t sendingLen = 0;
 
-    // set up packet (seq#, crc, flag, data)
     if (len > 0)
     {
-        memcpy(&packet[sizeof(Header)], buff, len);
+        payloadSum = inPacketSum(csumCopy(&packet[sizeof(Header)], buff, len));
     }
-    sendingLen = createHeader(len, flag, seqNum, packet);
+    sendingLen = patchHeader(len, flag, seqNum, packet, payloadSum);
 
-    sentLen = safeSendTo(packet, sendingLen, connection);
-    return sentLen;
+    return safeSendTo(packet, sendingLen, connection);
+}
+
+// Sends a packet whose len bytes of data already sit right after sizeof(Header) bytes
+// of room, the header is filled in front of the data so nothing gets copied
+int32_t sendInPlace(uint8_t * packet, uint32_t len, Connection * connection,
+                    uint8_t flag, uint32_t seqNum)
+{
+    int32_t sendingLen = createHeader(len, flag, seqNum, packet);
+
+    return safeSendTo(packet, sendingLen, connection);
 }
 
 // Receives a buffer of data from the socket, retrieves the header, returns the data length
+// at most len bytes are received, so buff has to hold len - sizeof(Header) bytes of data
 int32_t recvBuff(uint8_t * buff, int32_t len, int32_t recvSockNum,
     Connection * connection, uint8_t * flag, uint32_t * seqNum)
     {
         uint8_t dataBuff[MAX_PACK_LEN];
         int32_t recvLen = 0;
         int32_t dataLen = 0;
+        uint16_t payloadSum = 0;
         
+    if (len > MAX_PACK_LEN)
+    {
+        len = MAX_PACK_LEN; // never more than dataBuff holds
+    }
     recvLen = safeRecvFrom(recvSockNum, dataBuff, len, connection);
 
-    dataLen = retrieveHeader(dataBuff, recvLen, flag, seqNum);
-    
+    if (recvLen < (int32_t)sizeof(Header))
+    {
+        return retrieveHeader(dataBuff, recvLen, flag, seqNum); // runt, nothing to copy
+    }
+
+    // the data is summed while it is copied out, buff holds garbage if this returns CRC_ERROR
+    dataLen = recvLen - sizeof(Header);
+    payloadSum = inPacketSum(csumCopy(buff, &dataBuff[sizeof(Header)], dataLen));
+
     // dataLen could be -1 if crc error or 0 if no data
-    if (dataLen > 0)
-    memcpy(buff, &dataBuff[sizeof(Header)], dataLen);
-    
-    return dataLen;
+    return retrieveHeaderSum(dataBuff, recvLen, payloadSum, flag, seqNum);
+}
+
+// Receives every packet already queued on the socket (up to count) with one recvmmsg() call.
+// Each packet is scattered: its header into heads[i] and its data straight into bodies[i] (at
+// most bodyLen bytes), so it can be kept where it landed. The header is checked against the
+// data's sum, dataLens[i] is the data length or CRC_ERROR (runts and packets too big for
+// bodyLen too) - returns the number of packets received
+int recvBuffs(uint8_t heads[][sizeof(Header)], uint8_t ** bodies, int32_t bodyLen, int32_t * dataLens,
+              uint8_t * flags, uint32_t * seqNums, int count, int32_t recvSockNum, Connection * connection)
+{
+    uint8_t *headPtrs[count];
+    int recvLens[count];
+    int numRecv = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        headPtrs[i] = heads[i];
+    }
+
+    numRecv = safeRecvMmsgSplit(recvSockNum, headPtrs, sizeof(Header), bodies, bodyLen, recvLens, count, connection);
+
+    for (int i = 0; i < numRecv; i++)
+    {
+        if (recvLens[i] < (int)sizeof(Header))
+        {
+            dataLens[i] = CRC_ERROR;
+            continue;
+        }
+        // the data starts on an odd byte of the packet, its share of the sum is byte swapped
+        int32_t dataLen = recvLens[i] - sizeof(Header);
+        uint16_t payloadSum = (dataLen > 0) ? inPacketSum((uint16_t)~in_cksum((unsigned short *)bodies[i], dataLen)) : 0;
+        dataLens[i] = retrieveHeaderSum(heads[i], recvLens[i], payloadSum, &flags[i], &seqNums[i]);
+    }
+
+    return numRecv;
 }
 
 int createHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t * packet)
@@ -58,6 +112,137 @@ int createHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t * packet)
     return sizeof(Header) + len;
 }
 
+// builds the header for a payload kept apart from it (a pane sending straight out of an mmap'd
+// file) and hands back the payload's share of the checksum (a one's complement sum), so resends
+// of the same payload can go through patchHeader() without summing it again
+int createSplitHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t * header, const uint8_t * payload, uint16_t * payloadSum)
+{
+    *payloadSum = (len > 0) ? inPacketSum((uint16_t)~in_cksum((unsigned short *)payload, len)) : 0;
+
+    return patchHeader(len, flag, seqNum, header, *payloadSum);
+}
+
+// RFC 1624 style update: rebuilds the header for a new flag/seqNum in front of a payload whose
+// sum createSplitHeader() already gave back - O(1) instead of O(len)
+int patchHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t * packet, uint16_t payloadSum)
+{
+    Header *hdr = (Header *)packet;
+    uint16_t chksum = 0;
+    uint32_t netSeqNum = htonl(seqNum);
+
+    memcpy(&(hdr->seqNum), &netSeqNum, sizeof(netSeqNum));
+    hdr->flag = flag;
+
+    chksum = (uint16_t)~onesAdd(headerSum(flag, seqNum), payloadSum);
+    memcpy(&(hdr->chksum), &chksum, sizeof(chksum));
+
+    return sizeof(Header) + len;
+}
+
+// one's complement sum of the header words with the checksum zeroed, the byte after the flag
+// belongs to the payload so it counts as zero here - words are read in memory order like in_cksum()
+uint16_t headerSum(uint8_t flag, uint32_t seqNum)
+{
+    uint8_t words[sizeof(Header) + 1] = {0};
+    Header *hdr = (Header *)words;
+    uint16_t word = 0;
+    uint32_t sum = 0;
+
+    seqNum = htonl(seqNum);
+    memcpy(&(hdr->seqNum), &seqNum, sizeof(seqNum));
+    hdr->flag = flag;
+
+    for (size_t i = 0; i < sizeof(words); i += sizeof(word))
+    {
+        memcpy(&word, &words[i], sizeof(word));
+        sum += word;
+    }
+    return onesAdd(sum, 0);
+}
+
+// retrieveHeader() for a packet whose payload was already summed (by csumCopy()), only the
+// header words are read here
+int retrieveHeaderSum(uint8_t * dataBuff, int recvLen, uint16_t payloadSum, uint8_t * flag, uint32_t * seqNum)
+{
+    Header * hdr = (Header *)dataBuff;
+    uint16_t chksum = 0;
+    uint32_t netSeqNum = 0;
+
+    memcpy(&chksum, &(hdr->chksum), sizeof(chksum));
+    memcpy(&netSeqNum, &(hdr->seqNum), sizeof(netSeqNum));
+
+    // a good packet sums to 0xffff with its checksum included, in_cksum() != 0 otherwise
+    if (onesAdd(onesAdd(headerSum(hdr->flag, ntohl(netSeqNum)), chksum), payloadSum) != 0xffff)
+    {
+        return CRC_ERROR;
+    }
+    *flag = hdr->flag;
+    *seqNum = ntohl(netSeqNum);
+
+    return recvLen - sizeof(Header);
+}
+
+// copies len bytes from src to dst and returns their one's complement sum (folded, not
+// complemented) in the same pass, like the kernel's csum_and_copy - words are summed in
+// src's memory order starting at src, the same way in_cksum() reads them
+uint16_t csumCopy(uint8_t * dst, const uint8_t * src, uint32_t len)
+{
+    uint64_t sum = 0;
+    uint32_t w[4];
+    uint16_t half = 0;
+
+    while (len >= sizeof(w))
+    {
+        memcpy(w, src, sizeof(w));
+        memcpy(dst, w, sizeof(w));
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        src += sizeof(w);
+        dst += sizeof(w);
+        len -= sizeof(w);
+    }
+    while (len >= sizeof(half))
+    {
+        memcpy(&half, src, sizeof(half));
+        memcpy(dst, &half, sizeof(half));
+        sum += half;
+        src += sizeof(half);
+        dst += sizeof(half);
+        len -= sizeof(half);
+    }
+    if (len == 1)
+    {
+        half = 0;
+        *(uint8_t *)(&half) = *src;
+        *dst = *src;
+        sum += half;
+    }
+
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
+// the Header is 7 bytes so the payload starts on an odd byte of the packet, which swaps the
+// two bytes of every word it contributes - a csumCopy() sum becomes its share of the packet's
+uint16_t inPacketSum(uint16_t payloadSum)
+{
+    return (uint16_t)((payloadSum << 8) | (payloadSum >> 8));
+}
+
+// a + b with the end around carry folded back in
+uint16_t onesAdd(uint32_t a, uint32_t b)
+{
+    uint32_t sum = a + b;
+
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
 int retrieveHeader(uint8_t * dataBuff, int recvLen, uint8_t * flag, uint32_t * seqNum)
 {
     Header * hdr = (Header *)dataBuff;
@@ -79,34 +264,31 @@ int retrieveHeader(uint8_t * dataBuff, int recvLen, uint8_t * flag, uint32_t * s
     return retVal;
 }
 
-int processSelect(Connection * client, int * retryCnt, int selectTimeoutState, int dataReadyState, int doneState)
+int processSelect(Connection * client, RttEstimator * rtt, int selectTimeoutState, int dataReadyState, int doneState)
 {
     // returns:
-    // doneState if calling this function exceeds MAX_TRIES
+    // doneState if the backed off timeout passes RTO_MAX_US
     // selectTimeoutState if select times out without receiving anything
     // dataReadyState if select() returns saying data is ready to be read
 
     int retVal = dataReadyState;
+    uint64_t rto = getRto(rtt);
 
-    (*retryCnt)++;
-    if (*retryCnt > MAX_TRIES)
+    if (selectCall(client->socketNum, rto / 1000000, rto % 1000000) == 1)
+    {
+        resetBackoff(rtt); // other side answered
+        retVal = dataReadyState;
+    }
+    else if (backoffRtt(rtt) < 0)
     {
         printf("No response from other side for %d seconds, termination connection\n",
-        MAX_TRIES);
+        LONG_TIME);
         retVal = doneState;
     }
     else
     {
-        if (selectCall(client->socketNum, SHORT_TIME, 0) == 1)
-        {
-            *retryCnt = 0; // reset retry count
-            retVal = dataReadyState;
-        }
-        else
-        {
-            // data not yet ready
-            retVal = selectTimeoutState;
-        }
+        // data not yet ready, wait twice as long next time
+        retVal = selectTimeoutState;
     }
     return retVal;
 }
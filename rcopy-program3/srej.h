@@ -23,14 +23,21 @@
 #include "networks.h"
 #include "cpe464.h"
 #include "checksum.h"
+#include "rtt.h"
 
 #define MAX_PACK_LEN 1500
 #define BUFF_SIZE 4
 #define WIN_BUFF_LEN 8
 #define START_SEQ_NUM 1
-#define MAX_TRIES 10
-#define LONG_TIME 10
-#define SHORT_TIME 1
+#define LONG_TIME 10     // seconds of silence before giving up on the other side
+#define SHORT_TIME 1     // seconds, first retransmission timeout before there is an RTT sample
+#define RECV_BATCH 64   // most packets rcopy drains per wakeup
+#define SACK_MAP_LEN 32 // SACK bitmap bytes - 256 panes, covers rcopy's max window of 229
+#define RANGE_LEN 16    // FNAME byte range after the name's '\0': [offset (8 bytes)] [length (8 bytes)]
+#define FILE_SIZE_LEN 8 // FNAME_OK payload: the source file's size in bytes, 0 if it has none (a pipe)
+#define RANGE_TO_EOF INT64_MAX // FNAME range length for everything from the offset on, a resumed transfer
+#define NEXT_FILE_LEN 5 // NEXT_FILE payload: [batch index (4 bytes)] [1 = opened, 0 = skipped]
+#define CODEC_LEN 1     // codec byte ending an FNAME range or an FNAME_LIST, see codec.h
 
 #pragma pack(1)
 
@@ -45,9 +52,13 @@ enum FLAG
 {
     ACK_RR = 5,
     SREJ = 6,
-    FNAME = 8,
-    FNAME_OK = 9,
+    SACK = 7,   // [base seqNum (4 bytes)] [bitmap of panes buffered from base, plus EOF's (up to SACK_MAP_LEN bytes)]
+    FNAME = 8,  // [winSize (4 bytes)] [buffSize (4 bytes)] [fileName], one stream of several adds ['\0'] [range (RANGE_LEN bytes)] (more ranges for a delta) [codec (CODEC_LEN bytes), optional]
+    FNAME_OK = 9,   // [file size (FILE_SIZE_LEN bytes)]
     END_OF_FILE = 10,
+    FNAME_LIST = 11,    // [winSize (4 bytes)] [buffSize (4 bytes)] [fileName '\n' fileName ...] (['\0'] [codec (CODEC_LEN bytes)]) - a batch over one session
+    NEXT_FILE = 12,     // [NEXT_FILE_LEN bytes] in the data's seqNums, the packets after it belong to that batch entry
+    FNAME_SIGS = 13,    // FNAME's layout, the data is the file's chunk signatures (SIG_LEN each, delta.h) for a delta sync
     DATA = 16,
     SREJ_DATA = 17,
     TIMEOUT_DATA = 18,
@@ -58,10 +69,21 @@ enum FLAG
 
 int32_t sendBuff(uint8_t *buff, uint32_t len, Connection *connection,
                  uint8_t flag, uint32_t seqNum, uint8_t *packet);
+int32_t sendInPlace(uint8_t *packet, uint32_t len, Connection *connection,
+                    uint8_t flag, uint32_t seqNum);
 int createHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t *packet);
+int createSplitHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t *header, const uint8_t *payload, uint16_t *payloadSum);
+int patchHeader(uint32_t len, uint8_t flag, uint32_t seqNum, uint8_t *packet, uint16_t payloadSum);
+uint16_t headerSum(uint8_t flag, uint32_t seqNum);
+uint16_t onesAdd(uint32_t a, uint32_t b);
+int retrieveHeaderSum(uint8_t *dataBuff, int recvLen, uint16_t payloadSum, uint8_t *flag, uint32_t *seqNum);
+uint16_t csumCopy(uint8_t *dst, const uint8_t *src, uint32_t len);
+uint16_t inPacketSum(uint16_t payloadSum);
 int32_t recvBuff(uint8_t *buff, int32_t len, int32_t recvSockNum,
                  Connection *connection, uint8_t *flag, uint32_t *seqNum);
+int recvBuffs(uint8_t heads[][sizeof(Header)], uint8_t **bodies, int32_t bodyLen, int32_t *dataLens,
+              uint8_t *flags, uint32_t *seqNums, int count, int32_t recvSockNum, Connection *connection);
 int retrieveHeader(uint8_t *dataBuff, int recvLen, uint8_t *flag, uint32_t *seqNum);
-int processSelect(Connection *client, int *retryCnt, int selectTimeoutState, int dataReadyState, int doneState);
+int processSelect(Connection *client, RttEstimator *rtt, int selectTimeoutState, int dataReadyState, int doneState);
 
 #endif
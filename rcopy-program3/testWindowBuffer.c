@@ -6,78 +6,232 @@
 #include <string.h>
 #include "window.h"
 #include "buffer.h"
+#include "delta.h"
 
 #define TEST_WIN_SIZE 5
 #define TEST_DATA_SIZE 100
+#define TEST_OUT_FILE "testWindowBuffer.out"
+#define TEST_NEXT_FILE "testWindowBuffer.next"
+#define TEST_CHUNK_LEN 1400
+#define TEST_DELTA_LEN (1 << 20)
 
 void test_window()
 {
     printf("\n--- Testing Window Library ---\n");
     printf("\ntest:window:init\n");
 
-    initWindow(TEST_WIN_SIZE);
+    Window *win = initWindow(TEST_WIN_SIZE, TEST_DATA_SIZE);
+    Window *other = initWindow(TEST_WIN_SIZE, TEST_DATA_SIZE);
 
     uint8_t data[TEST_DATA_SIZE];
     memset(data, 'A', TEST_DATA_SIZE);
 
     printf("\ntest:window:addPane\n");
-    // Add panes
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
+    // Add panes, filling each one in place
+    for (uint32_t i = START_SEQ_NUM; i < START_SEQ_NUM + TEST_WIN_SIZE; i++)
     {
-        int result = addPane(data, TEST_DATA_SIZE, i);
+        memcpy(getPaneBuff(win), data, TEST_DATA_SIZE);
+        int result = addPane(win, TEST_DATA_SIZE, i);
         printf("addPane(seqNum=%u) = %d\n", i, result);
     }
 
+    printf("\ntest:window:getPaneBuff\n");
+    // Payload sits right after room for the header
+    Pane *pane = &win->paneBuff[START_SEQ_NUM % TEST_WIN_SIZE];
+    printf("payload offset = %ld (expect %zu), data='%c'\n", (long)(&pane->packet[sizeof(Header)] - pane->packet), sizeof(Header), pane->packet[sizeof(Header)]);
+    printf("payload cache line aligned = %d (expect 1)\n", ((uintptr_t)&pane->packet[sizeof(Header)] % SLAB_ALIGN) == 0);
+
     printf("\ntest:window:addPane:full\n");
     // Should fail: window full
-    int result = addPane(data, TEST_DATA_SIZE, TEST_WIN_SIZE);
-    printf("addPane(seqNum=%u) = %d (expect fail)\n", TEST_WIN_SIZE, result);
-    
-    printf("\ntest:window:resendPanes\n");
-    // Resend panes
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
-    {
-        Pane *pane = resendPanes(i);
-        if (pane)
-        {
-            printf("Resending pane at seqNum=%u, packetLen=%d\n", pane->seqNum, pane->packetLen);
-        }
-        else
-        {
-            printf("No pane to resend for seqNum=%u\n", i);
-        }
-    }
+    printf("getPaneBuff() = %p (expect nil)\n", (void *)getPaneBuff(win));
+    int result = addPane(win, TEST_DATA_SIZE, START_SEQ_NUM + TEST_WIN_SIZE);
+    printf("addPane(seqNum=%u) = %d (expect fail)\n", START_SEQ_NUM + TEST_WIN_SIZE, result);
+
+    printf("\ntest:window:independent\n");
+    // A second window is untouched by the first one filling up
+    printf("windowOpen(other) = %d (expect 1)\n", windowOpen(other));
+    memcpy(getPaneBuff(other), data, TEST_DATA_SIZE);
+    result = addPane(other, TEST_DATA_SIZE, START_SEQ_NUM);
+    printf("addPane(other, seqNum=%u) = %d\n", START_SEQ_NUM, result);
 
     printf("\ntest:window:markPaneAck\n");
     // Mark ACKs
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
+    for (uint32_t i = START_SEQ_NUM; i < START_SEQ_NUM + TEST_WIN_SIZE; i++)
     {
-        result = markPaneAck(i);
+        result = markPaneAck(win, i);
         printf("markPaneAck(seqNum=%u) = %d\n", i, result);
     }
 
     printf("\ntest:window:checkPaneAck\n");
     // Check ACKs
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
+    for (uint32_t i = START_SEQ_NUM; i < START_SEQ_NUM + TEST_WIN_SIZE; i++)
     {
-        result = checkPaneAck(i);
+        result = checkPaneAck(win, i);
         printf("checkPaneAck(seqNum=%u) = %d\n", i, result);
     }
 
     printf("\ntest:window:slideWindow\n");
     // Slide window
-    slideWindow(4);
+    slideWindow(win, START_SEQ_NUM + TEST_WIN_SIZE);
+    printf("getLowerBound() = %u, getCurrSeqNum() = %u\n", getLowerBound(win), getCurrSeqNum(win));
 
     printf("\ntest:window:addPane:afterSlide\n");
     // Add again
-    for (uint32_t i = TEST_WIN_SIZE; i < TEST_WIN_SIZE * 2; i++)
+    for (uint32_t i = START_SEQ_NUM + TEST_WIN_SIZE; i < START_SEQ_NUM + TEST_WIN_SIZE * 2; i++)
     {
-        result = addPane(data, TEST_DATA_SIZE, i);
+        memcpy(getPaneBuff(win), data, TEST_DATA_SIZE);
+        result = addPane(win, TEST_DATA_SIZE, i);
         printf("addPane(seqNum=%u) = %d\n", i, result);
     }
 
     printf("\ntest:window:free\n");
-    freeWindow();
+    freeWindow(win);
+    freeWindow(other);
+}
+
+void test_checksum()
+{
+    printf("\n--- Testing Header Checksum ---\n");
+    printf("\ntest:srej:patchHeader\n");
+    // A resend patched from the cached payload sum must match a full recompute, odd and even lengths
+    uint8_t packet[sizeof(Header) + TEST_DATA_SIZE + 1];
+    uint8_t fresh[sizeof(Header) + TEST_DATA_SIZE + 1];
+    for (int len = TEST_DATA_SIZE; len <= TEST_DATA_SIZE + 1; len++)
+    {
+        uint16_t payloadSum = 0;
+        uint8_t flag = 0;
+        uint32_t seqNum = 0;
+        for (int i = 0; i < len; i++)
+        {
+            packet[sizeof(Header) + i] = (uint8_t)(i * 37 + 11);
+        }
+        createSplitHeader(len, DATA, 7, packet, &packet[sizeof(Header)], &payloadSum);
+        patchHeader(len, TIMEOUT_DATA, 7, packet, payloadSum);
+        memcpy(fresh, packet, sizeof(Header) + len);
+        createHeader(len, TIMEOUT_DATA, 7, fresh);
+        int result = retrieveHeader(packet, sizeof(Header) + len, &flag, &seqNum);
+        printf("len %d: retrieveHeader() = %d (expect %d), flag = %u (expect %u), seqNum = %u (expect 7), same as recompute = %d (expect 1)\n",
+               len, result, len, flag, TIMEOUT_DATA, seqNum, memcmp(packet, fresh, sizeof(Header)) == 0);
+    }
+
+    printf("\ntest:srej:csumCopy\n");
+    // The fused copy has to land the same bytes and give the sum in_cksum() would, and a packet
+    // built from it has to pass retrieveHeaderSum()
+    uint8_t copy[TEST_DATA_SIZE + 1];
+    for (int len = TEST_DATA_SIZE; len <= TEST_DATA_SIZE + 1; len++)
+    {
+        uint8_t flag = 0;
+        uint32_t seqNum = 0;
+        uint16_t sum = csumCopy(copy, &packet[sizeof(Header)], len);
+        uint16_t want = (uint16_t)~in_cksum((unsigned short *)&packet[sizeof(Header)], len);
+        patchHeader(len, DATA, 9, packet, inPacketSum(sum));
+        int result = retrieveHeaderSum(packet, sizeof(Header) + len, inPacketSum(sum), &flag, &seqNum);
+        printf("len %d: copy matches = %d (expect 1), sum = 0x%04x (expect 0x%04x), retrieveHeaderSum() = %d (expect %d), in_cksum(packet) = %u (expect 0)\n",
+               len, memcmp(copy, &packet[sizeof(Header)], len) == 0, sum, want, result, len,
+               in_cksum((unsigned short *)packet, sizeof(Header) + len));
+    }
+}
+
+void test_codec()
+{
+    printf("\n--- Testing Codec ---\n");
+    printf("\ntest:codec:text\n");
+    // Repetitive text packs far more than a packet's worth of file into one chunk and comes back intact
+    static uint8_t plain[CODEC_MAX_IN];
+    static uint8_t back[CODEC_MAX_IN];
+    uint8_t chunk[TEST_CHUNK_LEN];
+    int32_t used = 0;
+    for (int i = 0; i < CODEC_MAX_IN; i++)
+    {
+        plain[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44] + (i / 4096);
+    }
+    int32_t len = packChunk(CODEC_LZ4, plain, CODEC_MAX_IN, chunk, TEST_CHUNK_LEN, &used);
+    int32_t result = unpackChunk(chunk, len, back, CODEC_MAX_IN);
+    printf("packChunk() = %d, kind = %u (expect %u), consumed = %d (expect > %d)\n", len, chunk[0], CHUNK_LZ4, used, TEST_CHUNK_LEN - 1);
+    printf("unpackChunk() = %d (expect %d), same = %d (expect 1)\n", result, used, result == used && memcmp(plain, back, used) == 0);
+
+    printf("\ntest:codec:random\n");
+    // Data that doesn't compress is stored, never more than a packet's worth
+    srandom(464);
+    for (int i = 0; i < CODEC_MAX_IN; i++)
+    {
+        plain[i] = (uint8_t)random();
+    }
+    len = packChunk(CODEC_LZ4, plain, CODEC_MAX_IN, chunk, TEST_CHUNK_LEN, &used);
+    result = unpackChunk(chunk, len, back, CODEC_MAX_IN);
+    printf("packChunk() = %d (expect %d), kind = %u (expect %u), unpackChunk() = %d, same = %d (expect 1)\n",
+           len, TEST_CHUNK_LEN, chunk[0], CHUNK_RAW, result, result == used && memcmp(plain, back, used) == 0);
+
+    printf("\ntest:codec:malformed\n");
+    // A match reaching back before the start of the output is rejected
+    uint8_t bad[] = {CHUNK_LZ4, 0x10, 'a', 0x05, 0x00, 0x00};
+    result = unpackChunk(bad, sizeof(bad), back, CODEC_MAX_IN);
+    printf("unpackChunk() = %d (expect -1)\n", result);
+
+    printf("\ntest:codec:buffer\n");
+    // A PacketBuffer with a codec writes what the chunk unpacks to
+    int outFileFd = open(TEST_OUT_FILE, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    PacketBuffer *pb = initPacketBuffer(TEST_WIN_SIZE, TEST_CHUNK_LEN, outFileFd);
+    memset(plain, 'q', CODEC_MAX_IN);
+    len = packChunk(CODEC_LZ4, plain, CODEC_MAX_IN, chunk, TEST_CHUNK_LEN, &used);
+    printf("setCodec() = %d (expect 0)\n", setCodec(pb, CODEC_LZ4));
+    result = writePacket(pb, chunk, len);
+    printf("writePacket(%d byte chunk) = %d (expect %d), getWriteOffset() = %lld (expect %d)\n",
+           len, result, CODEC_MAX_IN, (long long)getWriteOffset(pb), CODEC_MAX_IN);
+    flushStaged(pb);
+    result = pread(outFileFd, back, CODEC_MAX_IN, 0);
+    printf("file = %d bytes (expect %d), same = %d (expect 1)\n", result, CODEC_MAX_IN, memcmp(plain, back, CODEC_MAX_IN) == 0);
+    freePacketBuffer(pb);
+    close(outFileFd);
+    unlink(TEST_OUT_FILE);
+}
+
+void test_delta()
+{
+    printf("\n--- Testing Delta Chunking ---\n");
+    printf("\ntest:delta:cutChunk\n");
+    // Boundaries come from the content, never closer than the minimum or further than the maximum
+    static uint8_t file[TEST_DELTA_LEN + 1];
+    srandom(25);
+    for (int i = 0; i < TEST_DELTA_LEN; i++)
+    {
+        file[i] = (uint8_t)random();
+    }
+    int chunks = 0;
+    int inBounds = 1;
+    for (int32_t offset = 0, len = 0; offset < TEST_DELTA_LEN; offset += len, chunks++)
+    {
+        len = cutChunk(&file[offset], TEST_DELTA_LEN - offset);
+        inBounds = inBounds && len <= DELTA_MAX_CHUNK && (len >= DELTA_MIN_CHUNK || offset + len == TEST_DELTA_LEN);
+    }
+    printf("%d chunks in %d bytes, all in bounds = %d (expect 1)\n", chunks, TEST_DELTA_LEN, inBounds);
+
+    printf("\ntest:delta:findChunk\n");
+    // One byte inserted near the front shifts the rest of the file, the chunks after the edit are still found
+    DeltaIndex *index = initDeltaIndex(file, TEST_DELTA_LEN);
+    memmove(&file[101], &file[100], TEST_DELTA_LEN - 100);
+    file[100] = 'x';
+    int found = 0;
+    int32_t len = 0;
+    uint8_t sig[SIG_LEN];
+    for (int32_t offset = 0; offset < TEST_DELTA_LEN + 1; offset += len)
+    {
+        len = cutChunk(&file[offset], TEST_DELTA_LEN + 1 - offset);
+        signChunk(&file[offset], len, sig);
+        found += (findChunk(index, sig) >= 0);
+    }
+    printf("found %d of %d chunks (expect %d), sigLength() = %u (expect %d)\n", found, chunks, chunks - 1, sigLength(sig), len);
+    freeDeltaIndex(index);
+
+    printf("\ntest:delta:signChunk\n");
+    // The hash half of a signature is the chunk's SHA-256, "abc" is FIPS 180-4's first example
+    signChunk((const uint8_t *)"abc", 3, sig);
+    printf("sigLength() = %u (expect 3), SHA-256 = ", sigLength(sig));
+    for (int i = SIG_LEN - 32; i < SIG_LEN; i++)
+    {
+        printf("%02x", sig[i]);
+    }
+    printf(" (expect ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad)\n");
 }
 
 void test_buffer()
@@ -85,57 +239,100 @@ void test_buffer()
     printf("\n--- Testing Buffer Library ---\n");
     printf("\ntest:buffer:init\n");
 
-    initPacketBuffer(TEST_WIN_SIZE);
+    int outFileFd = open(TEST_OUT_FILE, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    PacketBuffer *pb = initPacketBuffer(TEST_WIN_SIZE, TEST_DATA_SIZE, outFileFd);
 
     uint8_t data[TEST_DATA_SIZE];
-    memset(data, 'B', TEST_DATA_SIZE);
 
     printf("\ntest:buffer:addPacket\n");
-    // Add packets
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
+    // Add packets after a hole at START_SEQ_NUM, each filled with its own seqNum
+    for (uint32_t i = START_SEQ_NUM + 1; i < START_SEQ_NUM + TEST_WIN_SIZE - 1; i++)
     {
-        int result = addPacket(data, TEST_DATA_SIZE, i);
+        memset(data, 'A' + i, TEST_DATA_SIZE);
+        int result = addPacket(pb, data, TEST_DATA_SIZE, i);
         printf("addPacket(seqNum=%u) = %d\n", i, result);
     }
 
-    printf("\ntest:buffer:addPacket:full\n");
-    // Should fail: buffer full
-    int result = addPacket(data, TEST_DATA_SIZE, TEST_WIN_SIZE);
-    printf("addPacket(seqNum=%u) = %d (expect fail)\n", TEST_WIN_SIZE, result);
+    printf("\ntest:buffer:addRecvSlot\n");
+    // The last one is "received" straight into a receive slot, which becomes its packet slot
+    uint32_t last = START_SEQ_NUM + TEST_WIN_SIZE - 1;
+    uint8_t *slot = getRecvSlots(pb)[0];
+    memset(slot, 'A' + last, TEST_DATA_SIZE);
+    int result = addRecvSlot(pb, 0, TEST_DATA_SIZE, last);
+    printf("addRecvSlot(seqNum=%u) = %d (expect 0), slot kept = %d (expect 1), new free slot = %d (expect 1)\n", last, result,
+           pb->buffer[last & pb->mask].packetData == slot, getRecvSlots(pb)[0] != slot);
+    result = addRecvSlot(pb, 0, getSlotLen(pb) + 1, last);
+    printf("addRecvSlot(len=%d) = %d (expect fail)\n", getSlotLen(pb) + 1, result);
 
-    printf("\ntest:buffer:markPacketReceived\n");
-    // Mark packets as received
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
-    {
-        result = markPacketReceived(i);
-        printf("markPacketReceived(seqNum=%u) = %d\n", i, result);
-    }
+    printf("\ntest:buffer:addPacket:outOfBounds\n");
+    // Should fail: past the end of the buffer window
+    result = addPacket(pb, data, TEST_DATA_SIZE, START_SEQ_NUM + TEST_WIN_SIZE);
+    printf("addPacket(seqNum=%u) = %d (expect fail)\n", START_SEQ_NUM + TEST_WIN_SIZE, result);
 
-    printf("\ntest:buffer:isPacketReceived\n");
-    // Check isPacketReceived
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
+    printf("\ntest:buffer:isWritten\n");
+    for (uint32_t i = START_SEQ_NUM; i < START_SEQ_NUM + TEST_WIN_SIZE; i++)
     {
-        result = isPacketReceived(i);
-        printf("isPacketReceived(seqNum=%u) = %d\n", i, result);
+        result = isWritten(pb, i);
+        printf("isWritten(seqNum=%u) = %d\n", i, result);
     }
 
-    printf("\ntest:buffer:getPacket\n");
-    // Get packets
-    uint8_t recvData[TEST_DATA_SIZE];
-    int packetLen = 0;
-    for (uint32_t i = 0; i < TEST_WIN_SIZE; i++)
+    printf("\ntest:buffer:getSackMap\n");
+    // Bit 0 is the hole at nextSeqNum, the buffered packets behind it set bits 1 through 4
+    uint8_t bitmap[SACK_MAP_LEN];
+    result = getSackMap(pb, bitmap, SACK_MAP_LEN);
+    printf("getSackMap() = %d (expect 1), bitmap[0] = 0x%02x (expect 0x1e)\n", result, bitmap[0]);
+
+    printf("\ntest:buffer:writePacket\n");
+    // Filling the hole writes it and flushes everything buffered behind it
+    memset(data, 'A' + START_SEQ_NUM, TEST_DATA_SIZE);
+    result = writePacket(pb, data, TEST_DATA_SIZE);
+    printf("writePacket(seqNum=%u) = %d (expect %d)\n", START_SEQ_NUM, result, TEST_DATA_SIZE * TEST_WIN_SIZE);
+    printf("getNextSeqNum() = %d, getStoredPackets() = %d\n", getNextSeqNum(pb), getStoredPackets(pb));
+
+    printf("\ntest:buffer:fileContents\n");
+    // The output file holds the packets in seqNum order once the staged writes are out
+    uint8_t readBack[TEST_DATA_SIZE];
+    result = flushStaged(pb);
+    printf("flushStaged() = %d (expect 0)\n", result);
+    lseek(outFileFd, 0, SEEK_SET);
+    for (uint32_t i = START_SEQ_NUM; i < START_SEQ_NUM + TEST_WIN_SIZE; i++)
     {
-        result = getPacket(recvData, &packetLen, i);
-        printf("getPacket(seqNum=%u) = %d, len=%d\n", i, result, packetLen);
+        result = read(outFileFd, readBack, TEST_DATA_SIZE);
+        printf("packet %u: len=%d, data='%c' (expect '%c')\n", i, result, readBack[0], 'A' + i);
     }
 
+    printf("\ntest:buffer:writeOffset\n");
+    // The offset a resume checkpoints is just past the last in-order byte, it can't move once data is in
+    printf("getWriteOffset() = %lld (expect %d)\n", (long long)getWriteOffset(pb), TEST_DATA_SIZE * TEST_WIN_SIZE);
+    result = setWriteOffset(pb, 0);
+    printf("setWriteOffset(0) after writing = %d (expect fail)\n", result);
+
+    printf("\ntest:buffer:switchOutput\n");
+    // A batch's NEXT_FILE takes up a seqNum with no data, what's buffered behind it goes into the next file
+    uint32_t boundary = getNextSeqNum(pb);
+    int nextFd = open(TEST_NEXT_FILE, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    memset(data, 'Z', TEST_DATA_SIZE);
+    addPacket(pb, data, TEST_DATA_SIZE, boundary + 1);
+    result = switchOutput(pb, nextFd);
+    printf("switchOutput() = %d (expect %d), getNextSeqNum() = %d (expect %u)\n", result, TEST_DATA_SIZE, getNextSeqNum(pb), boundary + 2);
+    result = flushStaged(pb);
+    printf("flushStaged() = %d (expect 0), next file = %lld bytes (expect %d), old file = %lld bytes (expect %d)\n", result,
+           (long long)lseek(nextFd, 0, SEEK_END), TEST_DATA_SIZE, (long long)lseek(outFileFd, 0, SEEK_END), TEST_DATA_SIZE * TEST_WIN_SIZE);
+
     printf("\ntest:buffer:free\n");
-    freePacketBuffer();
+    freePacketBuffer(pb);
+    close(outFileFd);
+    close(nextFd);
+    unlink(TEST_OUT_FILE);
+    unlink(TEST_NEXT_FILE);
 }
 
 int main()
 {
     test_window();
+    test_checksum();
+    test_codec();
+    test_delta();
     test_buffer();
     printf("\nAll tests completed.\n");
     return 0;
@@ -0,0 +1,228 @@
+// io_uring file I/O for the rcopy Project 3 Networks 464 class, straight on the syscalls
+
+#include "uring.h"
+
+#if IO_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct uring
+{
+    int fd;
+    uint8_t *rings;     // SQ and CQ rings share one mapping (IORING_FEAT_SINGLE_MMAP)
+    size_t ringsLen;
+    struct io_uring_sqe *sqes;
+    size_t sqesLen;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+    unsigned pending;   // submitted and not reaped yet
+};
+
+static int submit(Uring *ring, uint8_t opcode, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag);
+
+// func defs start
+
+Uring *initUring(unsigned entries)
+{
+    struct io_uring_params params;
+    Uring *ring = (Uring *)calloc(1, sizeof(Uring));
+    if (ring == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for io_uring.\n");
+        return NULL;
+    }
+
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0)
+    {
+        perror("initUring, io_uring_setup failed, using plain syscalls");
+        free(ring);
+        return NULL;
+    }
+    // one mapping for both rings and reads at the file position (offset -1) both came in 5.6
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_RW_CUR_POS) == 0)
+    {
+        fprintf(stderr, "Error: io_uring is too old, using plain syscalls.\n");
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->ringsLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > ring->ringsLen)
+    {
+        ring->ringsLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    }
+    ring->sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *rings = mmap(NULL, ring->ringsLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    void *sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (rings == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        perror("initUring, mmap");
+        if (rings != MAP_FAILED) munmap(rings, ring->ringsLen);
+        if (sqes != MAP_FAILED) munmap(sqes, ring->sqesLen);
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->rings = (uint8_t *)rings;
+    ring->sqes = (struct io_uring_sqe *)sqes;
+    ring->sqTail = (unsigned *)&ring->rings[params.sq_off.tail];
+    ring->sqMask = (unsigned *)&ring->rings[params.sq_off.ring_mask];
+    ring->sqArray = (unsigned *)&ring->rings[params.sq_off.array];
+    ring->cqHead = (unsigned *)&ring->rings[params.cq_off.head];
+    ring->cqTail = (unsigned *)&ring->rings[params.cq_off.tail];
+    ring->cqMask = (unsigned *)&ring->rings[params.cq_off.ring_mask];
+    ring->cqes = (struct io_uring_cqe *)&ring->rings[params.cq_off.cqes];
+    ring->entries = params.sq_entries;
+    ring->pending = 0;
+    return ring;
+}
+
+// closing the ring cancels what's queued but the kernel may still be copying into a buffer,
+// so reap everything first
+void freeUring(Uring *ring)
+{
+    uint64_t tag = 0;
+    int32_t res = 0;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+    while (uringWait(ring, &tag, &res) > 0)
+    {
+    }
+    munmap(ring->sqes, ring->sqesLen);
+    munmap(ring->rings, ring->ringsLen);
+    close(ring->fd);
+    free(ring);
+}
+
+int uringRead(Uring *ring, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag)
+{
+    return submit(ring, IORING_OP_READ, fd, buff, len, offset, tag);
+}
+
+int uringWrite(Uring *ring, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag)
+{
+    return submit(ring, IORING_OP_WRITE, fd, buff, len, offset, tag);
+}
+
+int uringWait(Uring *ring, uint64_t *tag, int32_t *res)
+{
+    if (ring == NULL || tag == NULL || res == NULL)
+    {
+        fprintf(stderr, "Error: Invalid parameters for uringWait.\n");
+        return -1;
+    }
+
+    while (ring->pending > 0)
+    {
+        unsigned head = *ring->cqHead;
+
+        // the kernel fills the CQE before it publishes the tail
+        if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+            *tag = cqe->user_data;
+            *res = cqe->res;
+            __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+            ring->pending--;
+            return 1;
+        }
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+        {
+            perror("uringWait, io_uring_enter");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// fills the next SQE and hands it to the kernel with one io_uring_enter()
+static int submit(Uring *ring, uint8_t opcode, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag)
+{
+    int ret = 0;
+
+    if (ring == NULL || buff == NULL)
+    {
+        fprintf(stderr, "Error: Invalid parameters for io_uring submit.\n");
+        return -1;
+    }
+    if (ring->pending >= ring->entries)
+    {
+        fprintf(stderr, "Error: io_uring has %u requests in flight already.\n", ring->pending);
+        return -1;
+    }
+
+    unsigned tail = *ring->sqTail;
+    unsigned idx = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buff;
+    sqe->len = len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = tag;
+    ring->sqArray[idx] = idx;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    while ((ret = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR)
+    {
+    }
+    if (ret < 1)
+    {
+        perror("io_uring submit, io_uring_enter");
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE); // not consumed, take it back
+        return -1;
+    }
+    ring->pending++;
+    return 0;
+}
+
+// func defs end
+
+#else
+
+// built without IO_URING, every caller stays on the plain syscalls
+
+Uring *initUring(unsigned entries)
+{
+    return NULL;
+}
+
+void freeUring(Uring *ring)
+{
+}
+
+int uringRead(Uring *ring, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag)
+{
+    return -1;
+}
+
+int uringWrite(Uring *ring, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag)
+{
+    return -1;
+}
+
+int uringWait(Uring *ring, uint64_t *tag, int32_t *res)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,33 @@
+// written by Lukas Shipley
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifndef IO_URING
+#define IO_URING 0  // 1 = file reads/writes go through io_uring, set from the Makefile
+#endif
+#define URING_ENTRIES 4 // submission queue depth, each user keeps at most one request in flight
+#define URING_CUR_POS ((off_t)-1) // offset for reads at the file position, works on pipes too
+
+typedef struct uring Uring; // one ring per FileSource/PacketBuffer, raw io_uring syscalls no liburing
+
+// NULL when built without IO_URING or the kernel refuses a ring (seccomp, io_uring_disabled,
+// older than 5.6) - callers keep the plain syscall path for that
+Uring *initUring(unsigned entries);
+void freeUring(Uring *ring); // waits for anything still in flight so its buffer can be freed after
+
+// queue one read/write of len bytes at offset and submit it right away - 0 or -1 on error
+int uringRead(Uring *ring, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag);
+int uringWrite(Uring *ring, int fd, uint8_t *buff, uint32_t len, off_t offset, uint64_t tag);
+
+// blocks for the next completion, *res is the syscall's return (-errno on failure) - returns 1,
+// 0 if nothing is in flight, or -1 on error
+int uringWait(Uring *ring, uint64_t *tag, int32_t *res);
+
+#endif
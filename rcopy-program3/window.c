@@ -2,68 +2,76 @@
 
 #include "window.h"
 
-// globs
-Window *win = NULL;
+// retransmit timer heap helpers, nothing outside window.c touches the heap
+static void armPaneTimer(Window *win, uint32_t idx);
+static void stopPaneTimer(Window *win, uint32_t idx);
+static void swapHeap(Window *win, uint32_t a, uint32_t b);
+static void siftUp(Window *win, uint32_t pos);
+static void siftDown(Window *win, uint32_t pos);
 
 // func defs start
 
-// setup window
-void initWindow(uint32_t winSize, int buffSize)
+// setup a window, returns the new window or NULL on error
+Window *initWindow(uint32_t winSize, int buffSize)
 {
-    if (win != NULL || winSize > MAX_PANES)
+    if (winSize == 0 || winSize > MAX_PANES)
     {
-        fprintf(stderr, "Error: Size exceeds maximum window size (2^30 or 1 GiB) or window already initialized which should not happen.\n");
-        return;
+        fprintf(stderr, "Error: Size exceeds maximum window size (2^30 or 1 GiB) or is zero.\n");
+        return NULL;
     }
 
-    win = (Window *)calloc(1, sizeof(Window));
+    Window *win = (Window *)calloc(1, sizeof(Window));
     if (win == NULL)
     {
         fprintf(stderr, "Error: Failed to allocate memory for window struct.\n");
-        return;
+        return NULL;
     }
 
     win->winSize = winSize;
+    win->limit = winSize;
+    uint32_t slots = ringSize(winSize);  // power of two so a pane's slot is seqNum & mask, no divide
+    win->mask = slots - 1;
 
-    win->paneBuff = (Pane *)calloc(winSize, sizeof(Pane));
-    if (win->paneBuff == NULL)
+    // one slab: [Pane array][timer heap][packet slots], the metadata the slide, ACK and timer
+    // code walks stays dense and apart from the packet bytes. At most winSize panes have timers
+    size_t panesLen = SLAB_ROUND((size_t)slots * sizeof(Pane));
+    size_t heapLen = SLAB_ROUND((size_t)winSize * sizeof(uint32_t));
+    size_t stride = SLAB_ROUND(SLAB_ALIGN + buffSize);
+    win->slab = allocSlab(panesLen + heapLen + (size_t)slots * stride, &win->slabLen);
+    if (win->slab == NULL)
     {
-        fprintf(stderr, "Error: Failed to allocate memory for pane buffer.\n");
+        fprintf(stderr, "Error: Failed to allocate memory for the window's panes.\n");
         free(win);
-        win = NULL;
-        return;
+        return NULL;
     }
+    win->paneBuff = (Pane *)win->slab;
+    win->timerHeap = (uint32_t *)&win->slab[panesLen];
 
-    // initialize each pane in the buffer
-    for (int i = 0; i < winSize; i++)
+    // initialize each pane in the buffer - panes hold the whole wire packet so the header
+    // can be built in front of the payload without copying it. The header sits at the end of
+    // the slot's first cache line so the payload starts on the next one
+    for (uint32_t i = 0; i < slots; i++)
     {
-        win->paneBuff[i].packet = (uint8_t *)calloc(buffSize, sizeof(uint8_t));
-        if (win->paneBuff[i].packet == NULL)
-        {
-            fprintf(stderr, "Error: Failed to allocate memory for packet in pane at index %d.\n", i);
-            // free all previously allocated packets
-            for (uint32_t j = 0; j < i; j++)
-            {
-                free(win->paneBuff[j].packet);
-                win->paneBuff[j].packet = NULL;
-            }
-            free(win->paneBuff);
-            free(win);
-            win = NULL;
-            return;
-        }
+        win->paneBuff[i].packet = &win->slab[panesLen + heapLen + (size_t)i * stride + SLAB_ALIGN - sizeof(Header)];
         win->paneBuff[i].packetLen = 0;
         win->paneBuff[i].seqNum = 0;
+        win->paneBuff[i].sendTime = 0;
+        win->paneBuff[i].resent = 0;
+        win->paneBuff[i].heapIdx = -1;
         win->paneBuff[i].ack = 1;   // set ack to 1 so that addPane() can overwrite it
         // win->paneBuff[i].occupied = 0;
     }
 
     win->lower = 1; // the first expected seqNum should be 1
     win->curr = 1;
+    win->resentUpTo = 1;
+    win->heapLen = 0;
+
+    return win;
 }
 
 // self explanatory
-void freeWindow()
+void freeWindow(Window *win)
 {
     if (win == NULL)
     {
@@ -72,33 +80,42 @@ void freeWindow()
     }
     if (win->paneBuff)
     {
-        for (uint32_t i = 0; i < win->winSize; i++)
-        {
-            Pane *pane = &win->paneBuff[i];
-            if (pane->packet)
-            {
-                free(pane->packet);
-                pane->packet = NULL;
-                pane->packetLen = 0;
-                pane->seqNum = 0;
-                pane->ack = 0;
-                // pane->occupied = 0;
-            }
-        }
-        free(win->paneBuff);
+        // panes, timer heap and packets all live in the slab
+        freeSlab(win->slab, win->slabLen);
+        win->slab = NULL;
         win->paneBuff = NULL;
+        win->timerHeap = NULL;
+        win->heapLen = 0;
         win->winSize = 0;
         win->lower = 0;
         win->curr = 0;
+        win->resentUpTo = 0;
     }
     free(win);
-    win = NULL;
 }
 
-// insert a pane into the window
-int addPane(uint8_t *packet, int packetLen, uint32_t seqNum)
+// payload area of the next pane to add, read data straight into it then call addPane()
+// returns NULL if the window is closed
+uint8_t *getPaneBuff(Window *win)
+{
+    if (win == NULL || windowOpen(win) != 1)
+    {
+        return NULL;
+    }
+    return &win->paneBuff[win->curr & win->mask].packet[sizeof(Header)];
+}
+
+// insert the pane filled through getPaneBuff() into the window
+int addPane(Window *win, int packetLen, uint32_t seqNum)
 {
-    if (win == NULL || !(windowOpen()) || packet == NULL || packetLen <= 0 ||
+    return addPaneSlice(win, packetLen, seqNum, NULL);
+}
+
+// insert a pane whose payload lives somewhere else (a slice of an mmap'd file), sends and
+// resends go out of it directly with the header gathered in front
+int addPaneSlice(Window *win, int packetLen, uint32_t seqNum, const uint8_t *payload)
+{
+    if (win == NULL || !(windowOpen(win)) || packetLen <= 0 ||
         seqNum < win->lower || seqNum >= win->lower + win->winSize)
     {
         if (DEBUG_FLAG)
@@ -106,7 +123,6 @@ int addPane(uint8_t *packet, int packetLen, uint32_t seqNum)
             fprintf(stderr, "Error: Invalid parameters for addPane:\n");
             fprintf(stderr, " - Window: %p\n", (void *)win);
             fprintf(stderr, " - Window Size to see if full: %u\n", win ? win->winSize : 0);
-            fprintf(stderr, " - Packet: %p\n", (void *)packet);
             fprintf(stderr, " - Packet Length: %d\n", packetLen);
             fprintf(stderr, " - Sequence Number: %u\n", seqNum);
         }
@@ -122,7 +138,7 @@ int addPane(uint8_t *packet, int packetLen, uint32_t seqNum)
         return -1;
     }
 
-    uint32_t idx = win->curr % win->winSize;
+    uint32_t idx = win->curr & win->mask;
     Pane *pane = &win->paneBuff[idx];
     if (!pane->ack)
     {
@@ -136,16 +152,19 @@ int addPane(uint8_t *packet, int packetLen, uint32_t seqNum)
     // increment after adding
     win->curr++;
 
-    // pane->packet should already be allocated
+    // pane->packet should already be allocated and hold the payload
     if (!pane->packet)
     {
-        fprintf(stderr, "Error: addPacket called before initPacketBuffer.\n");
+        fprintf(stderr, "Error: addPane called before initWindow.\n");
         return -1;
     }
-    memcpy(pane->packet, packet, packetLen);
     pane->packetLen = packetLen;
+    pane->payload = (payload != NULL) ? payload : &pane->packet[sizeof(Header)];
     pane->seqNum = seqNum;
+    pane->sendTime = 0;
+    pane->resent = 0;
     pane->ack = 0;
+    pane->flag = 0;
 
     if (DEBUG_FLAG)
     {
@@ -154,8 +173,21 @@ int addPane(uint8_t *packet, int packetLen, uint32_t seqNum)
     return 0;
 }
 
+// control panes (a batch's NEXT_FILE) ride in the data's seqNums, a resend mustn't turn
+// them into SREJ_DATA/TIMEOUT_DATA
+int setPaneFlag(Window *win, uint32_t seqNum, uint8_t flag)
+{
+    if (win == NULL || seqNum < win->lower || seqNum >= win->curr || win->paneBuff[seqNum & win->mask].seqNum != seqNum)
+    {
+        fprintf(stderr, "Error: Invalid window or sequence number for setting a pane's flag.\n");
+        return -1;
+    }
+    win->paneBuff[seqNum & win->mask].flag = flag;
+    return 0;
+}
+
 // mark a pane as acked
-int markPaneAck(uint32_t ackedSeqNum)
+int markPaneAck(Window *win, uint32_t ackedSeqNum)
 {
     if (win == NULL || ackedSeqNum < win->lower || ackedSeqNum >= win->lower + win->winSize)
     {
@@ -163,10 +195,11 @@ int markPaneAck(uint32_t ackedSeqNum)
         return -1;
     }
 
-    uint32_t idx = ackedSeqNum % win->winSize;
+    uint32_t idx = ackedSeqNum & win->mask;
     Pane *pane = &win->paneBuff[idx];   // temp pane for reference
     if (pane->seqNum == ackedSeqNum)
     {
+        stopPaneTimer(win, idx);
         pane->ack = 1;
         if (DEBUG_FLAG)
         {
@@ -179,7 +212,7 @@ int markPaneAck(uint32_t ackedSeqNum)
 }
 
 // returns 1 if the pane is ACKed, 0 if not, -1 on error
-int checkPaneAck(uint32_t seqNum)
+int checkPaneAck(Window *win, uint32_t seqNum)
 {
     if (win == NULL || seqNum < win->lower || seqNum >= win->lower + win->winSize)
     {
@@ -187,7 +220,7 @@ int checkPaneAck(uint32_t seqNum)
         return -1;
     }
 
-    uint32_t idx = seqNum % win->winSize;
+    uint32_t idx = seqNum & win->mask;
     Pane *pane = &win->paneBuff[idx];
     if (pane->seqNum == seqNum)
     {
@@ -197,7 +230,7 @@ int checkPaneAck(uint32_t seqNum)
 }
 
 // slide window up to lowest unACKed sequence number
-void slideWindow(uint32_t newLow)
+void slideWindow(Window *win, uint32_t newLow)
 {
     if (win == NULL || newLow < win->lower || newLow > win->curr)
     {
@@ -212,47 +245,238 @@ void slideWindow(uint32_t newLow)
     // clear lower panes
     for (uint32_t seqNum = win->lower; seqNum < newLow; seqNum++)
     {
-        uint32_t idx = seqNum % win->winSize;
+        uint32_t idx = seqNum & win->mask;
         Pane *pane = &win->paneBuff[idx];
 
-        // don't free packet memory just set to 0 so that it can be overwritten later
-        // slide regardless of occupied and ack status because higher ACK was received
-        memset(pane->packet, 0, pane->packetLen);
+        // the packet bytes are left as they are, addPane() overwrites them, only the
+        // bookkeeping is reset - slide regardless of ack status because higher ACK was received
+        stopPaneTimer(win, idx);
         pane->packetLen = 0;
         pane->seqNum = 0;
+        pane->sendTime = 0;
+        pane->resent = 0;
         pane->ack = 1;  // leave ack set so that addPane() can overwrite it
     }
     win->lower = newLow;
 }
 
-// resends the lowest unACKed pane in the window
-int32_t resendPane(Connection *client, uint8_t flag, uint32_t seqNum, uint8_t *packet)
+// sends an unACKed pane straight out of the window - only the header in front of the
+// payload is rewritten, returns the length sent or -1 on error
+int32_t sendPane(Window *win, Connection *client, uint8_t flag, uint32_t seqNum)
 {
-    if (win == NULL || seqNum < win->lower || seqNum > win->curr)
+    if (win == NULL || seqNum < win->lower || seqNum >= win->curr)
     {
-        fprintf(stderr, "Error: Invalid window or sequence number for resending panes.\n");
+        fprintf(stderr, "Error: Invalid window or sequence number for sending panes.\n");
         return -1;
     }
 
-    int32_t packetLen = -1;
-    uint32_t idx = seqNum % win->winSize;
+    uint32_t idx = seqNum & win->mask;
     Pane *pane = &win->paneBuff[idx];
     if (pane->ack == 0 && pane->seqNum == seqNum)
     {
-        packetLen = sendBuff(pane->packet, pane->packetLen, client, flag, seqNum, packet);
-        if (DEBUG_FLAG)
+        int sendingLen = 0;
+        uint8_t *body = (uint8_t *)pane->payload;
+        flag = pane->flag ? pane->flag : flag;
+        if (pane->sendTime == 0)
+        {
+            sendingLen = createSplitHeader(pane->packetLen, flag, seqNum, pane->packet, pane->payload, &pane->payloadSum);
+        }
+        else
         {
-            printf("Resending pane at index %u with sequence number %u.\n", idx, seqNum);
+            sendingLen = patchHeader(pane->packetLen, flag, seqNum, pane->packet, pane->payloadSum); // only the flag changed
         }
-        return packetLen;
+        pane->sendTime = getTimeUs();
+        armPaneTimer(win, idx);
+        if (safeSendMmsgSplit(&pane->packet, sizeof(Header), &body, &pane->packetLen, 1, client) < 0)
+        {
+            win->sendFailed = 1;
+            return -1;
+        }
+        return sendingLen;
     }
 
     fprintf(stderr, "Error: Pane at index %u with sequence number %u not found or already ACKed.\n", idx, seqNum);
     return -1;
 }
 
+// sends count unACKed panes starting at seqNum in batches of MMSG_BATCH, each header is built
+// in front of its payload. Every pane's timer starts, once the socket buffer is full the rest
+// aren't sent and their timers resend them - returns the number of panes sent or -1 on error
+int32_t sendPanes(Window *win, Connection *client, uint8_t flag, uint32_t seqNum, uint32_t count)
+{
+    if (win == NULL || count == 0 || seqNum < win->lower || seqNum + count > win->curr)
+    {
+        fprintf(stderr, "Error: Invalid window or sequence number range for sending panes.\n");
+        return -1;
+    }
+
+    uint8_t *heads[MMSG_BATCH];
+    uint8_t *bodies[MMSG_BATCH];
+    int lens[MMSG_BATCH];
+    uint64_t now = getTimeUs();
+    int32_t sent = 0;
+    int full = 0;
+
+    for (uint32_t start = 0; start < count; start += MMSG_BATCH)
+    {
+        uint32_t batch = (count - start < MMSG_BATCH) ? count - start : MMSG_BATCH;
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            uint32_t paneSeqNum = seqNum + start + i;
+            Pane *pane = &win->paneBuff[paneSeqNum & win->mask];
+            if (pane->ack != 0 || pane->seqNum != paneSeqNum)
+            {
+                fprintf(stderr, "Error: Pane with sequence number %u not found or already ACKed.\n", paneSeqNum);
+                return -1;
+            }
+            heads[i] = pane->packet;
+            bodies[i] = (uint8_t *)pane->payload;
+            lens[i] = pane->packetLen;
+            createSplitHeader(pane->packetLen, pane->flag ? pane->flag : flag, paneSeqNum, pane->packet, pane->payload, &pane->payloadSum);
+            pane->sendTime = now;
+            armPaneTimer(win, paneSeqNum & win->mask);
+        }
+
+        if (full)
+        {
+            continue;
+        }
+        int32_t batchSent = safeSendMmsgSplit(heads, sizeof(Header), bodies, lens, batch, client);
+        if (batchSent < 0)
+        {
+            win->sendFailed = 1;
+            return -1;
+        }
+        sent += batchSent;
+        full = (batchSent < (int32_t)batch);
+    }
+    return sent;
+}
+
+// resends pane seqNum (a timer expired, or rcopy's SREJ/SACK asked for it) and marks it resent so
+// Karn's algorithm takes no RTT sample from its ACK - returns the packet length or -1 on error
+int32_t resendPane(Window *win, Connection *client, uint8_t flag, uint32_t seqNum)
+{
+    int32_t packetLen = sendPane(win, client, flag, seqNum);
+    if (packetLen >= 0)
+    {
+        win->paneBuff[seqNum & win->mask].resent = 1;
+        if (DEBUG_FLAG)
+        {
+            printf("Resending pane at index %u with sequence number %u.\n", seqNum & win->mask, seqNum);
+        }
+    }
+    return packetLen;
+}
+
+// RTT sample for the pane an ACK just covered - returns 0 if it isn't an unACKed pane in the
+// window, or if it or any pane below it was resent: either the ACK could be for either copy or
+// the cumulative ACK was held back until a resend filled the hole (Karn's algorithm)
+uint64_t getPaneRtt(Window *win, uint32_t ackedSeqNum)
+{
+    if (win == NULL || ackedSeqNum < win->lower || ackedSeqNum >= win->curr)
+    {
+        return 0;
+    }
+
+    Pane *pane = &win->paneBuff[ackedSeqNum & win->mask];
+    if (pane->seqNum != ackedSeqNum || pane->ack || pane->sendTime == 0)
+    {
+        return 0;
+    }
+    for (uint32_t seqNum = win->lower; seqNum <= ackedSeqNum; seqNum++)
+    {
+        if (win->paneBuff[seqNum & win->mask].resent)
+        {
+            return 0;
+        }
+    }
+    uint64_t sample = getTimeUs() - pane->sendTime;
+    return (sample > 0) ? sample : 1;
+}
+
+// handles a SACK bitmap (bit i set = base + i received): marks the received panes as ACKed and
+// resends every hole below the highest received pane in one pass, base itself is always a hole
+// holes a previous SACK already got resent aren't sent again until they become the base
+// returns the number of panes resent or -1 on error
+int32_t resendMissing(Window *win, Connection *client, uint8_t flag, uint32_t base, uint8_t *bitmap, int mapLen)
+{
+    if (win == NULL || bitmap == NULL || mapLen < 0)
+    {
+        fprintf(stderr, "Error: Invalid window or bitmap for resending missing panes.\n");
+        return -1;
+    }
+    uint32_t highest = base + 1; // one past the highest pane rcopy has, holes past it may still be in flight
+    int32_t resent = 0;
+
+    for (uint32_t i = 0; i < (uint32_t)mapLen * 8; i++)
+    {
+        if (bitmap[i / 8] & (1 << (i % 8)))
+        {
+            highest = base + i + 1;
+        }
+    }
+
+    for (uint32_t seqNum = base; seqNum < highest; seqNum++)
+    {
+        if (seqNum < win->lower || seqNum >= win->curr)
+        {
+            continue; // stale SACK, already slid past this one
+        }
+        uint32_t i = seqNum - base;
+        if (i < (uint32_t)mapLen * 8 && (bitmap[i / 8] & (1 << (i % 8))))
+        {
+            markPaneAck(win, seqNum); // rcopy has it buffered, never resend it
+        }
+        else if ((seqNum == base || seqNum >= win->resentUpTo) && resendPane(win, client, flag, seqNum) >= 0)
+        {
+            resent++;
+        }
+    }
+    if (highest > win->resentUpTo)
+    {
+        win->resentUpTo = highest;
+    }
+    return resent;
+}
+
+// send time of the unACKed pane that was sent longest ago, its timer is the next one to
+// expire - returns 0 if no pane timer is running
+uint64_t getOldestSendTime(Window *win)
+{
+    if (win == NULL || win->heapLen == 0)
+    {
+        return 0;
+    }
+    return win->paneBuff[win->timerHeap[0]].sendTime;
+}
+
+// resends every unACKed pane last sent at or before cutoff (now - RTO), oldest first - each
+// resend restarts that pane's timer so the loop ends - returns the number of panes resent
+int32_t resendExpired(Window *win, Connection *client, uint8_t flag, uint64_t cutoff)
+{
+    if (win == NULL)
+    {
+        fprintf(stderr, "Error: Window is NULL.\n");
+        return -1;
+    }
+    int32_t resent = 0;
+
+    while (win->heapLen > 0 && win->paneBuff[win->timerHeap[0]].sendTime <= cutoff)
+    {
+        uint32_t idx = win->timerHeap[0];
+        if (resendPane(win, client, flag, win->paneBuff[idx].seqNum) < 0)
+        {
+            stopPaneTimer(win, idx); // shouldn't happen, don't spin on it
+            continue;
+        }
+        resent++;
+    }
+    return resent;
+}
+
 // get the base sequence number
-uint32_t getLowerBound()
+uint32_t getLowerBound(Window *win)
 {
     if (win == NULL)
     {
@@ -263,7 +487,7 @@ uint32_t getLowerBound()
 }
 
 // get the current sequence number
-uint32_t getCurrSeqNum()
+uint32_t getCurrSeqNum(Window *win)
 {
     if (win == NULL)
     {
@@ -273,21 +497,118 @@ uint32_t getCurrSeqNum()
     return win->curr;
 }
 
+// the congestion controller's cwnd - panes already out past a smaller limit stay in flight,
+// nothing new goes out until the window drains below it
+void setWindowLimit(Window *win, uint32_t limit)
+{
+    if (win == NULL)
+    {
+        fprintf(stderr, "Error: Window is NULL.\n");
+        return;
+    }
+    if (limit < 1) limit = 1;
+    if (limit > win->winSize) limit = win->winSize;
+    win->limit = limit;
+}
+
+// start (or restart after a resend) the timer for the pane at idx, keyed by its sendTime
+static void armPaneTimer(Window *win, uint32_t idx)
+{
+    Pane *pane = &win->paneBuff[idx];
+
+    if (pane->heapIdx < 0)
+    {
+        pane->heapIdx = win->heapLen;
+        win->timerHeap[win->heapLen++] = idx;
+        siftUp(win, pane->heapIdx);
+    }
+    else
+    {
+        siftDown(win, pane->heapIdx); // sendTime only moves later
+    }
+}
+
+// the pane at idx got ACKed or slid out, drop its timer
+static void stopPaneTimer(Window *win, uint32_t idx)
+{
+    int pos = win->paneBuff[idx].heapIdx;
+
+    if (pos < 0)
+    {
+        return;
+    }
+    win->heapLen--;
+    if ((uint32_t)pos != win->heapLen)
+    {
+        uint32_t moved = win->timerHeap[win->heapLen]; // last entry fills the hole
+        swapHeap(win, pos, win->heapLen);
+        siftUp(win, pos);
+        siftDown(win, win->paneBuff[moved].heapIdx);
+    }
+    win->paneBuff[idx].heapIdx = -1;
+}
+
+static void swapHeap(Window *win, uint32_t a, uint32_t b)
+{
+    uint32_t tmp = win->timerHeap[a];
+    win->timerHeap[a] = win->timerHeap[b];
+    win->timerHeap[b] = tmp;
+    win->paneBuff[win->timerHeap[a]].heapIdx = a;
+    win->paneBuff[win->timerHeap[b]].heapIdx = b;
+}
+
+static void siftUp(Window *win, uint32_t pos)
+{
+    while (pos > 0)
+    {
+        uint32_t parent = (pos - 1) / 2;
+        if (win->paneBuff[win->timerHeap[parent]].sendTime <= win->paneBuff[win->timerHeap[pos]].sendTime)
+        {
+            break;
+        }
+        swapHeap(win, pos, parent);
+        pos = parent;
+    }
+}
+
+static void siftDown(Window *win, uint32_t pos)
+{
+    while (1)
+    {
+        uint32_t child = 2 * pos + 1;
+        if (child >= win->heapLen)
+        {
+            break;
+        }
+        if (child + 1 < win->heapLen &&
+            win->paneBuff[win->timerHeap[child + 1]].sendTime < win->paneBuff[win->timerHeap[child]].sendTime)
+        {
+            child++;
+        }
+        if (win->paneBuff[win->timerHeap[pos]].sendTime <= win->paneBuff[win->timerHeap[child]].sendTime)
+        {
+            break;
+        }
+        swapHeap(win, pos, child);
+        pos = child;
+    }
+}
+
 // returns 1 if window is open, 0 if closed
-int windowOpen()
+int windowOpen(Window *win)
 {
     if (win == NULL)
     {
         fprintf(stderr, "Error: Window is NULL.\n");
         return -1;
     }
-    // uint32_t idx = win->curr % win->winSize;
+    // uint32_t idx = win->curr & win->mask;
     // Pane *pane = &win->paneBuff[idx];
     // if (pane->ack)
     // {
     //     return 1; // window is open
     // }
     // return 0; // window is full
-    return ((win->curr - win->lower) < win->winSize) && (win->paneBuff[win->curr % win->winSize].ack);  // span is less than winSize and the current pane is free
+    return ((win->curr - win->lower) < win->limit) && (win->paneBuff[win->curr & win->mask].ack);  // span is less than the congestion limit and the current pane is free
 }
 // func defs end
@@ -11,39 +11,67 @@
 
 #include "networks.h"
 #include "srej.h"
+#include "slab.h"
 
+#ifndef DEBUG_FLAG
 #define DEBUG_FLAG 1 // ~!*
+#endif
 #define MAX_PANES 1073741824 // 2^30 bytes = 1 GiB - winSize must be less than this number
 
 typedef struct
 {
-    int packetLen;
-    uint8_t *packet;
+    int packetLen;      // payload length, not counting the header
+    uint8_t *packet;    // wire packet - Header followed by the payload
+    const uint8_t *payload; // data sent after the Header - packet's own payload area or a slice of an mmap'd file
     uint32_t seqNum;
+    uint64_t sendTime;  // monotonic us of the last send
+    int resent;     // 1 = sent more than once so its ACK can't be timed (Karn's algorithm)
+    uint16_t payloadSum;    // payload's share of the checksum from the first send, resends only redo the header
+    int heapIdx;    // spot in the window's timer heap, -1 = no retransmit timer running
     int ack;        // 1 = ACK/unoccupied, 0 = NAK/occupied
+    uint8_t flag;   // 0 = sent with the caller's flag, else always this one, resends too (a NEXT_FILE)
     // int occupied;   // 1 = occupied, 0 = empty
 } Pane; // like a pane of glass in the sliding window - panes hold relevant packet data for storage
 
 typedef struct
 {
     uint32_t winSize;   // max packets in flight - winSize panes wide
+    uint32_t mask;      // ring has mask + 1 (winSize rounded up to a power of two) panes
+    uint32_t limit;     // congestion window, windowOpen() stops at this many in flight (<= winSize)
     Pane *paneBuff; // array of Pane structs
     uint32_t lower; // lowest unACKed sequence number
     uint32_t curr;  // current sequence number to send
+    uint32_t resentUpTo;    // SACK holes below this were already resent once, only the base hole gets resent again
+    uint32_t *timerHeap;    // min-heap of pane indexes keyed by sendTime - every unACKed pane has its own timer
+    uint32_t heapLen;
+    uint8_t *slab;  // one mapping holding paneBuff, timerHeap and every pane's packet slot
+    size_t slabLen;
+    int sendFailed; // 1 = a send to the other side failed, the transfer can't go on
 } Window;
 
-void initWindow(uint32_t winSize, int buffSize);
-void freeWindow();
+// every call takes the window it works on so one process can run many transfers at once
+Window *initWindow(uint32_t winSize, int buffSize);
+void freeWindow(Window *win);
 
-int addPane(uint8_t *packet, int packetLen, uint32_t seqNum);
-int markPaneAck(uint32_t ackedSeqNum);
-int checkPaneAck(uint32_t seqNum);
-void slideWindow(uint32_t newLow);
+uint8_t *getPaneBuff(Window *win); // payload area of the next pane, NULL if window closed
+int addPane(Window *win, int packetLen, uint32_t seqNum);
+int addPaneSlice(Window *win, int packetLen, uint32_t seqNum, const uint8_t *payload); // payload must outlive the pane, NULL = getPaneBuff()
+int setPaneFlag(Window *win, uint32_t seqNum, uint8_t flag); // pane keeps this flag on every send
+int markPaneAck(Window *win, uint32_t ackedSeqNum);
+int checkPaneAck(Window *win, uint32_t seqNum);
+void slideWindow(Window *win, uint32_t newLow);
 
-int32_t resendPane(Connection *client, uint8_t flag, uint32_t seqNum, uint8_t *packet);
-uint32_t getLowerBound();   // lowest unACKed sequence number
-uint32_t getCurrSeqNum();
+int32_t sendPane(Window *win, Connection *client, uint8_t flag, uint32_t seqNum);
+int32_t sendPanes(Window *win, Connection *client, uint8_t flag, uint32_t seqNum, uint32_t count);
+int32_t resendPane(Window *win, Connection *client, uint8_t flag, uint32_t seqNum);
+int32_t resendMissing(Window *win, Connection *client, uint8_t flag, uint32_t base, uint8_t *bitmap, int mapLen);
+uint64_t getPaneRtt(Window *win, uint32_t ackedSeqNum); // us since the pane was sent, 0 = no valid sample
+uint64_t getOldestSendTime(Window *win); // send time of the pane whose timer expires first, 0 = none running
+int32_t resendExpired(Window *win, Connection *client, uint8_t flag, uint64_t cutoff); // resend panes sent at or before cutoff
+uint32_t getLowerBound(Window *win);   // lowest unACKed sequence number
+uint32_t getCurrSeqNum(Window *win);
+void setWindowLimit(Window *win, uint32_t limit); // cap panes in flight below winSize, clamped to 1..winSize
 
-int windowOpen(); // 1 = open, 0 = closed
+int windowOpen(Window *win); // 1 = open, 0 = closed
 
 #endif
@@ -36,8 +36,55 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CKSUM_X86
+#endif
+
+/*
+ * The one's complement sum doesn't care how the words are grouped: 2^16 = 1 mod 0xffff,
+ * so adding 32 bit words into a 64 bit accumulator and folding at the end gives exactly
+ * the same 16 bit result as adding one 16 bit word at a time.  Each version below
+ * returns the unfolded 64 bit sum of len bytes, an odd last byte is padded with zero
+ * like the original routine did.
+ */
+typedef uint64_t (*cksum_fn)(const unsigned char *buf, int len);
+
+static uint64_t cksum_portable(const unsigned char *buf, int len);
+#ifdef CKSUM_X86
+static uint64_t cksum_sse2(const unsigned char *buf, int len);
+static uint64_t cksum_avx2(const unsigned char *buf, int len);
+#endif
+
+static cksum_fn cksum_impl = NULL;
+static const char *cksum_impl_name = NULL;
+
+/* picks the widest version this CPU runs, once */
+static void cksum_select(void)
+{
+        cksum_impl = cksum_portable;
+        cksum_impl_name = "portable";
+#ifdef CKSUM_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+                cksum_impl = cksum_avx2;
+                cksum_impl_name = "avx2";
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+                cksum_impl = cksum_sse2;
+                cksum_impl_name = "sse2";
+        }
+#endif
+}
+
 /*
  * in_cksum --
  *      Checksum routine for Internet Protocol family headers (C Version)
@@ -47,25 +94,106 @@
  */
 unsigned short in_cksum(unsigned short *addr, int len)
 {
-        register int sum = 0;
-        unsigned short answer = 0;
-        register unsigned short *w = addr;
-        register int nleft = len;
+        uint64_t sum = 0;
+
+        if (cksum_impl == NULL)
+        {
+                cksum_select();
+        }
+        sum = cksum_impl((const unsigned char *)addr, len);
+
+        while (sum >> 16)
+        {
+                sum = (sum & 0xffff) + (sum >> 16);
+        }
+        return (unsigned short)~sum;
+}
+
+/* name of the version in_cksum dispatches to, for the benchmark */
+const char *in_cksum_impl(void)
+{
+        if (cksum_impl == NULL)
+        {
+                cksum_select();
+        }
+        return cksum_impl_name;
+}
+
+/* 16 bytes per pass as four 32 bit words, then the leftover words and odd byte */
+static uint64_t cksum_portable(const unsigned char *buf, int len)
+{
+        uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+        uint32_t w[4];
+        uint16_t half = 0;
 
-        while (nleft > 1)
+        while (len >= 16)
+        {
+                memcpy(w, buf, 16);
+                sum0 += w[0];
+                sum1 += w[1];
+                sum2 += w[2];
+                sum3 += w[3];
+                buf += 16;
+                len -= 16;
+        }
+        while (len >= 2)
         {
-                sum += *w++;
-                nleft -= 2;
+                memcpy(&half, buf, 2);
+                sum0 += half;
+                buf += 2;
+                len -= 2;
         }
+        if (len == 1)
+        {
+                half = 0;
+                *(unsigned char *)(&half) = *buf;
+                sum0 += half;
+        }
+        return sum0 + sum1 + sum2 + sum3;
+}
+
+#ifdef CKSUM_X86
+/* widen 32 bit lanes to 64 bits against zero so the adds never carry out */
+__attribute__((target("sse2")))
+static uint64_t cksum_sse2(const unsigned char *buf, int len)
+{
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc0 = _mm_setzero_si128();
+        __m128i acc1 = _mm_setzero_si128();
+        uint64_t lanes[2];
 
-        if (nleft == 1)
+        while (len >= 16)
         {
-                *(unsigned char *)(&answer) = *(unsigned char *)w;
-                sum += answer;
+                __m128i v = _mm_loadu_si128((const __m128i *)buf);
+                acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+                acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+                buf += 16;
+                len -= 16;
         }
+        _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+        return lanes[0] + lanes[1] + cksum_portable(buf, len);
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_avx2(const unsigned char *buf, int len)
+{
+        __m256i zero = _mm256_setzero_si256();
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        __m128i acc;
+        uint64_t lanes[2];
 
-        sum = (sum >> 16) + (sum & 0xffff);
-        sum += (sum >> 16);
-        answer = ~sum;
-        return answer;
+        while (len >= 32)
+        {
+                __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+                acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+                acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+                buf += 32;
+                len -= 32;
+        }
+        acc0 = _mm256_add_epi64(acc0, acc1);
+        acc = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        return lanes[0] + lanes[1] + cksum_portable(buf, len);
 }
+#endif
@@ -3,6 +3,7 @@
  */
 
 unsigned short in_cksum(unsigned short *addr,int len);
+const char *in_cksum_impl(void);     /* "avx2", "sse2" or "portable" */
 
 
 
@@ -0,0 +1,123 @@
+// Microbenchmark and bit-for-bit check of in_cksum() against the original 16 bit loop
+// usage: cksumBench [iterations per size]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+
+#define MAX_LEN 9000
+#define DEFAULT_ITERS 200000
+
+static const int sizes[] = {64, 128, 256, 512, 576, 1024, 1400, 1500, 4096, 9000};
+
+// the routine in_cksum() replaced, kept here as the reference
+static unsigned short ref_cksum(unsigned short *addr, int len)
+{
+    register int sum = 0;
+    unsigned short answer = 0;
+    register unsigned short *w = addr;
+    register int nleft = len;
+
+    while (nleft > 1)
+    {
+        sum += *w++;
+        nleft -= 2;
+    }
+
+    if (nleft == 1)
+    {
+        *(unsigned char *)(&answer) = *(unsigned char *)w;
+        sum += answer;
+    }
+
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    answer = ~sum;
+    return answer;
+}
+
+static double nowSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// every length 0..MAX_LEN at every alignment 0..3, random and all-ones data
+static int checkIdentical(uint8_t *buff)
+{
+    int bad = 0;
+
+    for (int fill = 0; fill < 2; fill++)
+    {
+        for (int i = 0; i < MAX_LEN + 8; i++)
+        {
+            buff[i] = fill ? 0xff : (uint8_t)rand();
+        }
+        for (int off = 0; off < 4; off++)
+        {
+            for (int len = 0; len <= MAX_LEN; len++)
+            {
+                unsigned short want = ref_cksum((unsigned short *)(buff + off), len);
+                unsigned short got = in_cksum((unsigned short *)(buff + off), len);
+                if (want != got && bad++ < 10)
+                {
+                    printf("MISMATCH len %d offset %d: reference 0x%04x in_cksum 0x%04x\n", len, off, want, got);
+                }
+            }
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    int iters = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERS;
+    uint8_t *buff = malloc(MAX_LEN + 8);
+    volatile unsigned short sink = 0;
+    int bad = 0;
+
+    if (buff == NULL || iters <= 0)
+    {
+        fprintf(stderr, "Usage %s [iterations per size]\n", argv[0]);
+        return 1;
+    }
+    srand(464);
+
+    printf("in_cksum implementation: %s\n", in_cksum_impl());
+    bad = checkIdentical(buff);
+    printf("bit-identical to the reference: %s\n\n", bad ? "NO" : "yes");
+
+    printf("%6s %14s %14s %8s\n", "bytes", "reference GB/s", "in_cksum GB/s", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int len = sizes[s];
+        double start = 0, refTime = 0, newTime = 0;
+
+        start = nowSec();
+        for (int i = 0; i < iters; i++)
+        {
+            buff[0] = (uint8_t)i; // keeps the compiler from hoisting the call out of the loop
+            sink += ref_cksum((unsigned short *)buff, len);
+        }
+        refTime = nowSec() - start;
+
+        start = nowSec();
+        for (int i = 0; i < iters; i++)
+        {
+            buff[0] = (uint8_t)i;
+            sink += in_cksum((unsigned short *)buff, len);
+        }
+        newTime = nowSec() - start;
+
+        printf("%6d %14.2f %14.2f %7.2fx\n", len,
+               (double)len * iters / refTime / 1e9, (double)len * iters / newTime / 1e9, refTime / newTime);
+    }
+
+    free(buff);
+    return bad ? 1 : 0;
+}